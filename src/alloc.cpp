@@ -0,0 +1,30 @@
+#include "alloc.hpp"
+
+#ifdef COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t allocations = 0;
+
+uint64_t allocationCount() {
+  return allocations;
+}
+
+// Hidden so the plugin's own calls bind to these and Hyprland keeps the
+// standard ones. GCC ignores the attribute here with a warning, CMake links
+// with -Bsymbolic-functions there instead. The matching deletes stay the
+// standard ones, which free() just the same.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+__attribute__((visibility("hidden"))) void *operator new(std::size_t size) {
+  allocations++;
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+__attribute__((visibility("hidden"))) void *operator new[](std::size_t size) {
+  return ::operator new(size);
+}
+#pragma GCC diagnostic pop
+#endif
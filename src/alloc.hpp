@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made by the plugin's own code on the calling thread.
+// operator new is replaced inside the plugin only, so nothing Hyprland
+// allocates itself is counted. Only with -DCOUNT_ALLOCATIONS=ON, always 0
+// otherwise.
+#ifdef COUNT_ALLOCATIONS
+uint64_t allocationCount();
+#else
+inline uint64_t allocationCount() {
+  return 0;
+}
+#endif
@@ -0,0 +1,306 @@
+#include "atlas.hpp"
+#include "container.hpp"
+#include "defines.hpp"
+#include "manager.hpp"
+#include <aquamarine/output/Output.hpp>
+#include <drm_fourcc.h>
+#include <src/Compositor.hpp>
+#include <src/helpers/Format.hpp>
+#include <src/helpers/Monitor.hpp>
+#define private public
+#include <src/render/OpenGL.hpp>
+#include <src/render/Renderer.hpp>
+#undef private
+
+// Keeps linear filtering from bleeding neighbours into a preview.
+static constexpr int PADDING = 2;
+
+size_t framebufferBytes(const Vector2D &size, uint32_t format) {
+  const auto fmt = NFormatUtils::getPixelFormatFromDRM(format);
+  return (size_t)size.x * (size_t)size.y * (fmt ? fmt->bytesPerBlock : 4);
+}
+
+bool PreviewAtlas::configure(PHLMONITOR monitor) {
+  if (!monitor || monitor->m_pixelSize.x <= 0 || monitor->m_pixelSize.y <= 0)
+    return false;
+
+  // Pages are sized to the largest output and rendered with it, so moving
+  // focus between outputs keeps them. Only a mode change or hotplug that
+  // changes the largest size starts over.
+  PHLMONITOR largest = monitor;
+  for (const auto &m : g_pCompositor->m_monitors) {
+    if (m->m_pixelSize.x * m->m_pixelSize.y > largest->m_pixelSize.x * largest->m_pixelSize.y)
+      largest = m;
+  }
+  if (largest->m_pixelSize != pageSize) {
+    LOG(INFO, "atlas: pages {} -> {}", pageSize, largest->m_pixelSize);
+    clear();
+    pageSize = largest->m_pixelSize;
+  }
+  renderWith = largest;
+
+  // New captures follow the focused output's format, pages of the other one
+  // stay in use until their slots are gone.
+  format = monitor->m_output->state->state().drmFormat;
+  return true;
+}
+
+PreviewAtlas::Shelf *PreviewAtlas::Page::shelfAt(double y) {
+  for (auto &shelf : shelves) {
+    if (y >= shelf.y && y < shelf.y + shelf.height + PADDING)
+      return &shelf;
+  }
+  return nullptr;
+}
+
+std::optional<CBox> PreviewAtlas::Page::allocate(int w, int h, const Vector2D &size) {
+  const int cw = w + PADDING, ch = h + PADDING;
+
+  // Smallest freed cell it fits in, the rest of the cell stays free.
+  auto best = freed.end();
+  for (auto it = freed.begin(); it != freed.end(); ++it) {
+    if (it->width >= cw && it->height >= ch && (best == freed.end() || it->width * it->height < best->width * best->height))
+      best = it;
+  }
+  if (best != freed.end()) {
+    const CBox cell = *best;
+    freed.erase(best);
+    if (cell.width > cw)
+      freed.emplace_back(cell.x + cw, cell.y, cell.width - cw, cell.height);
+    if (cell.height > ch)
+      freed.emplace_back(cell.x, cell.y + ch, (double)cw, cell.height - ch);
+    if (auto *shelf = shelfAt(cell.y))
+      shelf->used++;
+    used++;
+    return CBox{cell.x, cell.y, (double)w, (double)h};
+  }
+
+  // Only share a shelf with slots of roughly the same height.
+  for (auto &shelf : shelves) {
+    if (h <= shelf.height && h * 4 >= shelf.height * 3 && shelf.x + w <= size.x) {
+      const CBox box{(double)shelf.x, (double)shelf.y, (double)w, (double)h};
+      shelf.x += cw;
+      shelf.used++;
+      used++;
+      return box;
+    }
+  }
+
+  const int top = shelves.empty() ? 0 : shelves.back().y + shelves.back().height + PADDING;
+  if (top + h > size.y || w > size.x)
+    return std::nullopt;
+
+  shelves.push_back({top, h, cw, 1});
+  used++;
+  return CBox{0.0, (double)top, (double)w, (double)h};
+}
+
+void PreviewAtlas::Page::release(const CBox &box) {
+  used--;
+  auto *shelf = shelfAt(box.y);
+  if (!shelf)
+    return;
+
+  // Last one on the shelf, the whole shelf is free again.
+  if (--shelf->used == 0) {
+    const int top = shelf->y, bottom = shelf->y + shelf->height + PADDING;
+    std::erase_if(freed, [&](const CBox &cell) { return cell.y >= top && cell.y < bottom; });
+    shelf->x = 0;
+    // an empty shelf at the bottom can come back at any height
+    while (!shelves.empty() && shelves.back().used == 0)
+      shelves.pop_back();
+    return;
+  }
+
+  CBox cell{box.x, box.y, box.width + PADDING, box.height + PADDING};
+  for (bool merged = true; merged;) {
+    merged = false;
+    for (auto it = freed.begin(); it != freed.end(); ++it) {
+      const bool row = it->y == cell.y && it->height == cell.height && (it->x + it->width == cell.x || cell.x + cell.width == it->x);
+      const bool column = it->x == cell.x && it->width == cell.width && (it->y + it->height == cell.y || cell.y + cell.height == it->y) && shelfAt(it->y) == shelf;
+      if (!row && !column)
+        continue;
+      cell = CBox{std::min(cell.x, it->x), std::min(cell.y, it->y), row ? cell.width + it->width : cell.width, column ? cell.height + it->height : cell.height};
+      freed.erase(it);
+      merged = true;
+      break;
+    }
+  }
+  freed.push_back(cell);
+}
+
+uint32_t PreviewAtlas::formatFor(int lod) const {
+  // back cards are small and blurry anyway, 16 bits are plenty
+  if (Config::compactPreviews >= 2 && lod > 0)
+    return DRM_FORMAT_RGB565;
+  // HDR outputs can be 10 bit or wider, previews don't need that
+  if (Config::compactPreviews >= 1)
+    return DRM_FORMAT_XBGR8888;
+  return format;
+}
+
+std::optional<AtlasSlot> PreviewAtlas::allocate(const Vector2D &size, uint32_t fmt) {
+  const int w = std::ceil(size.x);
+  const int h = std::ceil(size.y);
+  if (w <= 0 || h <= 0 || w > pageSize.x || h > pageSize.y)
+    return std::nullopt;
+
+  for (size_t i = 0; i < pages.size(); ++i) {
+    if (!pages[i].fb || pages[i].format != fmt)
+      continue;
+    if (auto box = pages[i].allocate(w, h, pageSize))
+      return AtlasSlot{i, *box, generation};
+  }
+
+  const auto current = bytes();
+  if (current > 0 && current + framebufferBytes(pageSize, fmt) > limit)
+    return std::nullopt;
+
+  // reuse the index of a page that emptied out
+  auto it = std::ranges::find_if(pages, [](const auto &p) { return !p.fb; });
+  if (it == pages.end())
+    it = pages.insert(pages.end(), Page{});
+  auto &page = *it;
+  page.fb = makeUnique<CFramebuffer>();
+  page.format = fmt;
+  g_pHyprRenderer->makeEGLCurrent();
+  if (!page.fb->alloc(pageSize.x, pageSize.y, fmt)) {
+    LOG(ERR, "atlas: failed to allocate page {}", pages.size());
+    page.fb.reset();
+    return std::nullopt;
+  }
+
+  if (auto box = page.allocate(w, h, pageSize))
+    return AtlasSlot{(size_t)std::distance(pages.begin(), it), *box, generation};
+  return std::nullopt;
+}
+
+void PreviewAtlas::release(const AtlasSlot &slot) {
+  if (!valid(slot))
+    return;
+
+  auto &page = pages[slot.page];
+  page.release(slot.box);
+  if (page.used == 0) {
+    page.shelves.clear();
+    page.freed.clear();
+    retire(std::move(page.fb), framebufferBytes(pageSize, page.format));
+  }
+}
+
+bool PreviewAtlas::valid(const AtlasSlot &slot) const {
+  return slot.generation == generation && slot.page < pages.size();
+}
+
+uint32_t PreviewAtlas::formatOf(const AtlasSlot &slot) const {
+  return valid(slot) ? pages[slot.page].format : 0;
+}
+
+void PreviewAtlas::snapshot(PHLMONITOR monitor, const std::vector<WindowCard *> &cards) {
+  LOG_SCOPE()
+  if (cards.empty())
+    return;
+  // the viewport comes from the monitor, it has to cover the whole page
+  if (const auto target = renderWith.lock())
+    monitor = target;
+
+  g_pHyprRenderer->makeEGLCurrent();
+
+  // What the damage leaves alone is carried over from the front slots.
+  for (const auto card : cards) {
+    if (card->back && card->copyFrom && valid(*card->back) && valid(*card->copyFrom))
+      copy(*card->copyFrom, *card->back);
+  }
+
+  for (size_t i = 0; i < pages.size(); ++i) {
+    if (!pages[i].fb)
+      continue;
+    CRegion damage;
+    for (const auto card : cards) {
+      if (card->back && card->back->page == i && valid(*card->back))
+        damage.add(card->snapshotDamage);
+    }
+    if (damage.empty())
+      continue;
+
+    if (!g_pHyprRenderer->beginRender(monitor, damage, RENDER_MODE_FULL_FAKE, nullptr, pages[i].fb.get()))
+      continue;
+
+    // clear() and the texture draws are scissored to the damage, other slots survive.
+    g_pHyprOpenGL->clear(CHyprColor{0, 0, 0, 1.0f});
+    g_pHyprRenderer->m_bBlockSurfaceFeedback = true;
+    for (const auto card : cards) {
+      if (card->back && card->back->page == i && valid(*card->back))
+        card->renderSnapshot();
+    }
+    g_pHyprRenderer->m_bBlockSurfaceFeedback = false;
+    g_pHyprRenderer->endRender();
+  }
+
+  // Nothing samples the new captures before the GPU is through with them.
+  for (const auto card : cards) {
+    if (card->inflight)
+      card->fenceSnapshot();
+  }
+}
+
+void PreviewAtlas::copy(const AtlasSlot &from, const AtlasSlot &to) {
+  const auto &src = pages[from.page].fb, &dst = pages[to.page].fb;
+  if (!src || !dst)
+    return;
+  const auto &a = from.box, &b = to.box;
+  // blits are scissored too
+  g_pHyprOpenGL->scissor(nullptr);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, src->m_fb);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst->m_fb);
+  glBlitFramebuffer(a.x, a.y, a.x + a.width, a.y + a.height, b.x, b.y, b.x + b.width, b.y + b.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+SP<CTexture> PreviewAtlas::texture(const AtlasSlot &slot) const {
+  if (!valid(slot) || !pages[slot.page].fb)
+    return nullptr;
+  return pages[slot.page].fb->getTexture();
+}
+
+std::pair<Vector2D, Vector2D> PreviewAtlas::uv(const AtlasSlot &slot) const {
+  return {slot.box.pos() / pageSize, (slot.box.pos() + slot.box.size()) / pageSize};
+}
+
+void PreviewAtlas::setLimit(size_t bytes) {
+  limit = bytes;
+}
+
+size_t PreviewAtlas::bytes() const {
+  size_t total = 0;
+  for (const auto &page : pages) {
+    if (page.fb)
+      total += framebufferBytes(pageSize, page.format);
+  }
+  for (const auto &r : retired)
+    total += r.bytes;
+  return total;
+}
+
+Vector2D PreviewAtlas::size() const {
+  return pageSize;
+}
+
+void PreviewAtlas::clear() {
+  for (auto &page : pages)
+    retire(std::move(page.fb), framebufferBytes(pageSize, page.format));
+  pages.clear();
+  generation++;
+}
+
+// The worker may still be drawing into it, it goes once the GPU got past
+// the last capture queued so far.
+void PreviewAtlas::retire(UP<CFramebuffer> fb, size_t bytes) {
+  if (fb && manager && manager->worker.pending())
+    retired.emplace_back(Retired{std::move(fb), manager->worker.issued(), bytes});
+}
+
+void PreviewAtlas::reap() {
+  if (!retired.empty())
+    std::erase_if(retired, [](const Retired &r) { return !manager || manager->worker.done(r.serial); });
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "defines.hpp"
+#include <hyprutils/math/Box.hpp>
+#include <hyprutils/math/Vector2D.hpp>
+#include <optional>
+#define private public
+#include <src/render/Framebuffer.hpp>
+#undef private
+#include <src/render/Texture.hpp>
+
+class WindowCard;
+
+// Bytes a framebuffer of this size and format takes.
+size_t framebufferBytes(const Vector2D &size, uint32_t format);
+
+struct AtlasSlot {
+  size_t page = 0;
+  CBox box;
+  uint64_t generation = 0;
+};
+
+// Previews packed into a few large framebuffers with a shelf allocator, so
+// every dirty card on a page is captured in a single render pass.
+// Captures go to a fresh back slot and are only drawn once their fence has
+// signalled, so drawing never waits on a capture in flight.
+// Pages are sized to the largest output and rendered with that one, since
+// beginRender() sets the viewport from the monitor. Pages of different
+// formats live side by side.
+class PreviewAtlas {
+public:
+  bool configure(PHLMONITOR monitor);
+  // Page format for a card at the given detail level, see compact_previews.
+  uint32_t formatFor(int lod) const;
+  std::optional<AtlasSlot> allocate(const Vector2D &size, uint32_t format);
+  void release(const AtlasSlot &slot);
+  bool valid(const AtlasSlot &slot) const;
+  uint32_t formatOf(const AtlasSlot &slot) const;
+  void snapshot(PHLMONITOR monitor, const std::vector<WindowCard *> &cards);
+  SP<CTexture> texture(const AtlasSlot &slot) const;
+  std::pair<Vector2D, Vector2D> uv(const AtlasSlot &slot) const;
+  // Size of every page, in pixels.
+  Vector2D size() const;
+  void clear();
+  // Frees the pages the snapshot worker was done with.
+  void reap();
+  // Pages are only added while under this many bytes. Always allows one.
+  void setLimit(size_t bytes);
+  size_t bytes() const;
+
+private:
+  struct Shelf {
+    int y;
+    int height;
+    int x;
+    // slots on it, it starts over from the left once they're all gone
+    int used = 0;
+  };
+
+  // Empty pages drop their framebuffer but keep their index, so slots
+  // pointing at other pages stay valid.
+  // Freed space goes back as cells (a slot plus the padding right of and
+  // below it). Taking a cell splits off what's left of it, giving one back
+  // merges it with the free neighbours on its shelf.
+  struct Page {
+    UP<CFramebuffer> fb;
+    uint32_t format = 0;
+    std::vector<Shelf> shelves;
+    std::vector<CBox> freed;
+    size_t used = 0;
+
+    std::optional<CBox> allocate(int w, int h, const Vector2D &size);
+    void release(const CBox &box);
+    Shelf *shelfAt(double y);
+  };
+
+  // Same-sized box from one slot to another, on the GPU.
+  void copy(const AtlasSlot &from, const AtlasSlot &to);
+  // Frees fb once the snapshot worker can't be drawing into it anymore.
+  void retire(UP<CFramebuffer> fb, size_t bytes);
+
+  // Framebuffers of pages that went away with captures still in flight,
+  // with the last capture queued at the time.
+  struct Retired {
+    UP<CFramebuffer> fb;
+    uint64_t serial;
+    size_t bytes;
+  };
+
+  std::vector<Page> pages;
+  std::vector<Retired> retired;
+  Vector2D pageSize;
+  uint32_t format = 0;
+  uint64_t generation = 1;
+  size_t limit = SIZE_MAX;
+  PHLMONITORREF renderWith;
+};
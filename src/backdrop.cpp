@@ -0,0 +1,159 @@
+#include "backdrop.hpp"
+#include "manager.hpp"
+#include <src/Compositor.hpp>
+#include <src/desktop/Workspace.hpp>
+#include <src/helpers/Monitor.hpp>
+#include <src/render/pass/RectPassElement.hpp>
+#include <src/render/pass/TexPassElement.hpp>
+#include <unordered_set>
+#define private public
+#include <src/render/OpenGL.hpp>
+#include <src/render/Renderer.hpp>
+#undef private
+
+// Fraction of the monitor resolution blurred backgrounds are captured at.
+static constexpr float BLUR_SCALE = 0.25f;
+
+BackdropCache::Backdrop BackdropCache::get(PHLMONITOR monitor, bool keepStale) {
+  if (!monitor || monitor->m_pixelSize.x <= 0 || monitor->m_pixelSize.y <= 0)
+    return {};
+  const auto workspace = monitor->m_activeWorkspace;
+  if (!workspace)
+    return {};
+
+  auto &entry = entries[workspace->m_id];
+  entry.used = NOW;
+  // Size changes with the monitor mode or the blur setting, either way it's stale.
+  const Vector2D size = (monitor->m_pixelSize * (Config::blurBG ? BLUR_SCALE : 1.0f)).round();
+  const bool fits = entry.size == size && entry.format == monitor->m_drmFormat && entry.capture && (!Config::blurBG || entry.blur);
+  if (!fits || (entry.dirty && !keepStale)) {
+    entry.size = size;
+    entry.format = monitor->m_drmFormat;
+    render(monitor, workspace, entry);
+  }
+
+  return {
+      .texture = entry.capture ? entry.capture->getTexture() : nullptr,
+      .blurred = entry.blur && Config::blurBG ? entry.blur->getTexture() : nullptr,
+  };
+}
+
+void BackdropCache::render(PHLMONITOR monitor, PHLWORKSPACE workspace, Entry &entry) {
+  LOG_SCOPE()
+  manager->count(manager->stats.backgrounds);
+  g_pHyprRenderer->makeEGLCurrent();
+
+  if (!entry.capture)
+    entry.capture = makeUnique<CFramebuffer>();
+  if (!entry.capture->isAllocated() || entry.capture->m_size != entry.size)
+    entry.capture->alloc(entry.size.x, entry.size.y, entry.format);
+
+  // The viewport still covers the whole monitor, anything outside the small
+  // framebuffer is simply dropped.
+  const CBox box = {{0, 0}, entry.size};
+  CRegion region = box;
+
+  g_pHyprRenderer->beginRender(monitor, region, RENDER_MODE_FULL_FAKE, nullptr, entry.capture.get(), false);
+  g_pHyprOpenGL->clear(CHyprColor{0, 0, 0, 1.0f});
+  // No frame callbacks from this, clients redrawing for it would invalidate it again.
+  g_pHyprRenderer->m_bBlockSurfaceFeedback = true;
+  g_pHyprRenderer->renderWorkspace(monitor, workspace, NOW, box);
+  g_pHyprRenderer->m_renderPass.render(region);
+  g_pHyprRenderer->m_renderPass.clear();
+  g_pHyprRenderer->m_bBlockSurfaceFeedback = false;
+  g_pHyprRenderer->endRender();
+  entry.dirty = false;
+  entry.rendered = NOW;
+
+  if (!Config::blurBG) {
+    entry.blur.reset();
+    return;
+  }
+
+  if (!entry.blur)
+    entry.blur = makeUnique<CFramebuffer>();
+  if (!entry.blur->isAllocated() || entry.blur->m_size != entry.size)
+    entry.blur->alloc(entry.size.x, entry.size.y, entry.format);
+
+  g_pHyprRenderer->beginRender(monitor, region, RENDER_MODE_FULL_FAKE, nullptr, entry.blur.get(), false);
+  CTexPassElement::SRenderData data;
+  data.tex = entry.capture->getTexture();
+  data.box = box;
+  data.blur = true;
+  g_pHyprRenderer->m_renderPass.add(makeUnique<CTexPassElement>(data));
+  CRectPassElement::SRectData blur;
+  blur.box = box;
+  blur.color = {0.0, 0.0, 0.0, 0.0};
+  blur.blur = true;
+  g_pHyprRenderer->m_renderPass.add(makeUnique<CRectPassElement>(blur));
+  g_pHyprRenderer->m_renderPass.render(region);
+  g_pHyprRenderer->m_renderPass.clear();
+  g_pHyprRenderer->endRender();
+}
+
+bool BackdropCache::stale(PHLMONITOR monitor) const {
+  if (!monitor || !monitor->m_activeWorkspace)
+    return false;
+  const auto it = entries.find(monitor->m_activeWorkspace->m_id);
+  return it == entries.end() || it->second.dirty;
+}
+
+Timestamp BackdropCache::rendered(PHLMONITOR monitor) const {
+  if (!monitor || !monitor->m_activeWorkspace)
+    return {};
+  const auto it = entries.find(monitor->m_activeWorkspace->m_id);
+  return it != entries.end() ? it->second.rendered : Timestamp{};
+}
+
+void BackdropCache::invalidate(WORKSPACEID workspace) {
+  if (auto it = entries.find(workspace); it != entries.end())
+    it->second.dirty = true;
+}
+
+void BackdropCache::invalidateAll() {
+  for (auto &[id, entry] : entries)
+    entry.dirty = true;
+}
+
+void BackdropCache::dropHidden() {
+  std::erase_if(entries, [](const auto &entry) {
+    return std::ranges::none_of(g_pCompositor->m_monitors, [&](const auto &mon) { return mon->m_activeWorkspace && mon->m_activeWorkspace->m_id == entry.first; });
+  });
+}
+
+void BackdropCache::clear() {
+  entries.clear();
+}
+
+size_t BackdropCache::bytes() const {
+  size_t total = 0;
+  for (const auto &[id, entry] : entries) {
+    if (entry.capture && entry.capture->isAllocated())
+      total += framebufferBytes(entry.size, entry.format);
+    if (entry.blur && entry.blur->isAllocated())
+      total += framebufferBytes(entry.size, entry.format);
+  }
+  return total;
+}
+
+void BackdropCache::trim(size_t budget) {
+  if (bytes() <= budget)
+    return;
+
+  std::unordered_set<WORKSPACEID> shown;
+  for (const auto &mon : g_pCompositor->m_monitors) {
+    if (mon->m_activeWorkspace)
+      shown.insert(mon->m_activeWorkspace->m_id);
+  }
+
+  while (bytes() > budget) {
+    auto oldest = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (!shown.contains(it->first) && (oldest == entries.end() || it->second.used < oldest->second.used))
+        oldest = it;
+    }
+    if (oldest == entries.end())
+      return;
+    entries.erase(oldest);
+  }
+}
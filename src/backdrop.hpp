@@ -0,0 +1,57 @@
+#pragma once
+
+#include "atlas.hpp"
+#include "defines.hpp"
+#include <hyprutils/math/Vector2D.hpp>
+#include <unordered_map>
+#define private public
+#include <src/render/Framebuffer.hpp>
+#undef private
+#include <src/render/Texture.hpp>
+
+// Workspace backgrounds for powersave/blur mode. Captured when the switcher
+// opens (nothing is watched while it's closed) and reused while it stays open
+// until something on that workspace changes. Between opens only the
+// framebuffers of the workspaces on screen are kept, to render into again.
+// With blur on the capture is done at a fraction of the monitor resolution
+// and the compositor's Kawase blur runs over that small area only; the
+// result is stretched back up when drawn, which a blurred image hides.
+class BackdropCache {
+public:
+  struct Backdrop {
+    SP<CTexture> texture;
+    SP<CTexture> blurred;
+  };
+
+  // With keepStale an invalidated backdrop is handed out as is, as long as
+  // it still fits the monitor. stale() keeps reporting it.
+  Backdrop get(PHLMONITOR monitor, bool keepStale = false);
+  // Whether get() would have to render, and when it last did for this monitor's workspace.
+  bool stale(PHLMONITOR monitor) const;
+  Timestamp rendered(PHLMONITOR monitor) const;
+  void invalidate(WORKSPACEID workspace);
+  void invalidateAll();
+  // Drops every workspace no monitor shows, they'd be rendered again before
+  // being drawn anyway.
+  void dropHidden();
+  void clear();
+  size_t bytes() const;
+  // Drops the least recently shown workspaces until under budget. Whatever
+  // monitors show right now is kept regardless.
+  void trim(size_t budget);
+
+private:
+  struct Entry {
+    UP<CFramebuffer> capture;
+    UP<CFramebuffer> blur;
+    Vector2D size;
+    uint32_t format = 0;
+    bool dirty = true;
+    Timestamp rendered;
+    Timestamp used;
+  };
+
+  void render(PHLMONITOR monitor, PHLWORKSPACE workspace, Entry &entry);
+
+  std::unordered_map<WORKSPACEID, Entry> entries;
+};
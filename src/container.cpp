@@ -1,6 +1,8 @@
 #include "container.hpp"
 #include "defines.hpp"
-#include "helpers.hpp"
+#include "manager.hpp"
+#include "renderer.hpp"
+#include "worker.hpp"
 #include <hyprutils/math/Vector2D.hpp>
 #include <src/desktop/state/FocusState.hpp>
 #include <src/desktop/view/Window.hpp>
@@ -8,34 +10,166 @@
 #include <src/protocols/PresentationTime.hpp>
 #include <src/render/Renderer.hpp>
 
+// Starts out as a bare descriptor, setResident() brings in the rest.
 WindowCard::WindowCard(PHLWINDOW window) : window(window) {
-  attachListeners(window->resource());
+  surfaceSize = window->wlSurface()->getSurfaceBoxGlobal().value_or({0, 0, 0, 0}).size();
   lastCommit = lastSnapshot = NOW;
 }
 
 WindowCard::~WindowCard() {
   commit.clear();
+  if (slot && manager)
+    manager->atlas.release(*slot);
+  releaseBack();
 }
 
 void WindowCard::attachListeners(SP<CWLSurfaceResource> surface) {
   if (!surface)
     return;
 
-  surface->breadthfirst([this](SP<CWLSurfaceResource> s, const Vector2D &offset, void *data) {
-    commit.push_back(s->m_events.commit.listen([this] {
-      const auto since = NOW - this->lastCommit;
-      if (FloatTime(since).count() > 0.0016) {
-        LOG(ERR, "In commit for: {}, since: {}", this->window->m_title, FloatTime(since).count());
-        this->ready = false;
-        this->lastCommit = NOW;
+  commit.clear();
+  surface->breadthfirst([this, root = surface.get()](SP<CWLSurfaceResource> s, const Vector2D &offset, void *data) {
+    commit.push_back(s->m_events.commit.listen([this, isRoot = s.get() == root, weak = WP<CWLSurfaceResource>(s)] {
+      // Nobody will look at it before the next open, just note that it
+      // changed. Sizes are caught up on in prepare(), backdrops in warmup().
+      if (!manager->isActive()) {
+        this->commitSeq++;
+        this->fullDamage = true;
+        manager->stats.idle++;
+        return;
       }
+
+      const auto s = weak.lock();
+      if (!s)
+        return;
+
+      if (isRoot)
+        this->refreshSize();
+
+      auto dmg = s->accumulateCurrentBufferDamage();
+      if (dmg.empty())
+        return;
+
+      this->commitSeq++;
+      this->lastCommit = NOW;
+      manager->wake();
+      manager->backdrops.invalidate(this->window->workspaceID());
+      if (this->fullDamage)
+        return;
+
+      const auto &state = s->m_current;
+      // Buffer damage only maps onto the surface by a plain scale. Rotated or
+      // cropped buffers are rare, those are just captured whole.
+      if (state.transform != WL_OUTPUT_TRANSFORM_NORMAL || state.viewport.hasSource) {
+        this->fullDamage = true;
+        this->damage.clear();
+        return;
+      }
+      if (state.bufferSize.x > 0 && state.bufferSize.y > 0)
+        dmg.scale(state.size / state.bufferSize);
+      this->damage[s.get()].add(dmg);
     }));
   },
                         nullptr);
 }
 
+// Resizes are the only thing that moves a settled layout.
+void WindowCard::refreshSize() {
+  const auto size = window->wlSurface()->getSurfaceBoxGlobal().value_or({0, 0, 0, 0}).size();
+  if (size == surfaceSize)
+    return;
+  surfaceSize = size;
+  manager->layoutSerial++;
+}
+
+void WindowCard::setResident(bool yes) {
+  if (yes == resident)
+    return;
+  resident = yes;
+  damage.clear();
+  fullDamage = true;
+  if (resident) {
+    // nothing was listening while it was out
+    refreshSize();
+    attachListeners(window->resource());
+    return;
+  }
+
+  commit.clear();
+  dropSnapshot();
+  direct = false;
+  title.clear();
+  titleSlot.reset();
+  titleWidth = -1;
+  titlePending = false;
+}
+
+// A capture sharper than needed is just drawn scaled down, only a card that
+// moved forward past its level needs a new one.
+void WindowCard::dropSnapshot() {
+  if (slot && manager)
+    manager->atlas.release(*slot);
+  slot.reset();
+  releaseBack();
+  captured = false;
+}
+
+void WindowCard::releaseBack() {
+  // the GPU may still be drawing into it, the worker gives it back once done
+  const bool handedOver = inflight && manager && manager->worker.forget(this);
+  if (back && manager && !handedOver)
+    manager->atlas.release(*back);
+  inflight = false;
+  back.reset();
+  copyFrom.reset();
+}
+
+bool WindowCard::dirty() const {
+  // an in flight capture is as good as done, later commits go in the next one
+  if (direct || inflight)
+    return false;
+  return commitSeq != snapshotSeq || !captured || !slot || !manager->atlas.valid(*slot) || wantedLod < lod;
+}
+
+// Surfaces beyond this and it's cheaper to draw one atlas slot.
+static constexpr size_t MAX_DIRECT_SURFACES = 4;
+
+// Simple trees are drawn straight from the client's buffers: always live, no
+// snapshot latency and no atlas space. Anything fancier (buffer transforms,
+// viewport crops, lots of subsurfaces) goes through the atlas.
+void WindowCard::updateMode() {
+  const auto resource = window->resource();
+  bool simple = Config::directPreviews && resource && surfaceSize.x >= 1.0 && surfaceSize.y >= 1.0;
+  size_t surfaces = 0;
+  if (simple) {
+    resource->breadthfirst([&](SP<CWLSurfaceResource> s, const Vector2D &offset, void *) {
+      surfaces++;
+      const auto &state = s->m_current;
+      if (!state.texture || state.transform != WL_OUTPUT_TRANSFORM_NORMAL || state.viewport.hasSource)
+        simple = false;
+    },
+                           nullptr);
+  }
+  simple = simple && surfaces <= MAX_DIRECT_SURFACES;
+  if (simple == direct)
+    return;
+
+  direct = simple;
+  if (direct)
+    dropSnapshot();
+}
+
+// For direct cards: whether the client committed since the last call.
+bool WindowCard::takeCommits() {
+  if (commitSeq == snapshotSeq)
+    return false;
+  snapshotSeq = commitSeq;
+  damage.clear();
+  return true;
+}
+
 void WindowCard::requestFrame(PHLMONITOR monitor) {
-  LOG(ERR, "{}: mapped: {}, ready: {}", window->m_title, window->resource()->m_mapped, ready);
+  LOG(ERR, "{}: mapped: {}, dirty: {}", window->m_title, window->resource()->m_mapped, dirty());
   if (!window->resource())
     return;
 
@@ -46,28 +180,46 @@ void WindowCard::requestFrame(PHLMONITOR monitor) {
                                    nullptr);
 }
 
-void WindowCard::draw(const CBox &box, const float scale, const float alpha = 1.0f) {
-  LOG_SCOPE();
+// Lays out the title bar and preview inside box. False if it's too small to draw.
+bool WindowCard::place(const CBox &box, const float scale) {
   if (!window)
-    return;
+    return false;
   // whoops, almost went to infinity with low scales.
   if (box.width <= 1.0f || box.height <= 1.0f)
-    return;
+    return false;
+
+  const auto parts = boxes(box, scale);
+  contentBox = parts.content;
+  titleBox = parts.title;
+  previewBox = parts.preview;
+  updateTitle(box, scale);
+  return true;
+}
 
-  contentBox = box;
-  contentBox.round();
-  contentBox = contentBox.expand(-Config::borderSize);
+WindowCard::Boxes WindowCard::boxes(const CBox &box, const float scale) {
+  CBox content = box;
+  content.round();
+  content = content.expand(-Config::borderSize);
   if (scale != 1.0f) {
     Vector2D center = box.pos() + box.size() / 2.0f;
-    contentBox.width *= scale;
-    contentBox.height *= scale;
-    contentBox.x = center.x - contentBox.width / 2.0f;
-    contentBox.y = center.y - contentBox.height / 2.0f;
+    content.width *= scale;
+    content.height *= scale;
+    content.x = center.x - content.width / 2.0f;
+    content.y = center.y - content.height / 2.0f;
   }
   const auto padding = 4;
   const auto barHeight = (Config::fontSize + padding) * scale;
-  titleBox = {contentBox.x, contentBox.y, contentBox.width, barHeight};
-  previewBox = {contentBox.x, contentBox.y + barHeight, contentBox.width, contentBox.height - barHeight};
+  return {
+      .content = content,
+      .title = {content.x, content.y, content.width, barHeight},
+      .preview = {content.x, content.y + barHeight, content.width, content.height - barHeight},
+  };
+}
+
+void WindowCard::draw(const CBox &box, const float scale, const float alpha, const bool active) {
+  LOG_SCOPE();
+  if (!place(box, scale))
+    return;
   /* Maybe..
   auto shadowBox = box;
   shadowBox.round();
@@ -75,107 +227,379 @@ void WindowCard::draw(const CBox &box, const float scale, const float alpha = 1.
   shadowBox.expand(DROPSHADOW);
   g_pHyprOpenGL->renderRoundedShadow(shadowBox, 2, 2, DROPSHADOW * 2, Colors::BLACK, 0.4f);
   */
-  drawTitle(box, scale, alpha);
-  drawBorder(alpha);
-  if (!fb.m_fb) {
+  drawTitle(alpha);
+  drawBorder(alpha, active);
+  const auto &atlas = manager->atlas;
+  if (direct) {
+    g_pHyprOpenGL->renderRect(previewBox, CHyprColor(0.0, 0.0, 0.0, alpha), {});
+    drawDirect(alpha);
+  } else if (!captured || !slot || !atlas.valid(*slot)) {
     g_pHyprOpenGL->renderRect(previewBox, CHyprColor(0.0, 0.0, 0.0, alpha), {});
   } else {
-    auto texture = fb.getTexture();
+    auto texture = atlas.texture(*slot);
     if (!texture) {
       LOG(ERR, "texture: nullptr");
       return;
     }
     LOG(ERR, "texpass: ({}) alpha: {}", window->m_title, alpha);
     g_pHyprOpenGL->renderRect(previewBox, CHyprColor(0.0, 0.0, 0.0, 1.0 * alpha), {});
-    g_pHyprOpenGL->renderTexture(texture, previewBox, {.a = alpha});
+    const auto [uvTL, uvBR] = atlas.uv(*slot);
+    g_pHyprOpenGL->m_renderData.primarySurfaceUVTopLeft = uvTL;
+    g_pHyprOpenGL->m_renderData.primarySurfaceUVBottomRight = uvBR;
+    g_pHyprOpenGL->renderTexture(texture, previewBox, {.a = alpha, .allowCustomUV = true});
+    g_pHyprOpenGL->m_renderData.primarySurfaceUVTopLeft = Vector2D(-1, -1);
+    g_pHyprOpenGL->m_renderData.primarySurfaceUVBottomRight = Vector2D(-1, -1);
+  }
+#ifndef NDEBUG
+  drawDebug();
+#endif
+}
+
+void WindowCard::queue(CardRenderer &renderer, const CBox &box, const float scale, const float alpha, const bool active) {
+  LOG_SCOPE();
+  if (!place(box, scale))
+    return;
+
+  CardRenderer::Card card;
+  card.box = contentBox;
+  card.barHeight = titleBox.height;
+  card.active = active;
+  card.alpha = alpha;
+  if (const auto texture = manager->titles.texture(); titleSlot && texture) {
+    card.title = CardRenderer::TITLE_TEXT;
+    card.titleBox = textBox;
+    card.titleUV = manager->titles.uv(*titleSlot);
+  } else if (!titleSlot)
+    card.title = CardRenderer::TITLE_PLACEHOLDER;
+
+  const auto &atlas = manager->atlas;
+  if (!direct && captured && slot && atlas.valid(*slot)) {
+    card.preview = atlas.texture(*slot);
+    card.previewUV = atlas.uv(*slot);
   }
+  renderer.add(card);
+  if (direct)
+    queueDirect(renderer, alpha);
 #ifndef NDEBUG
+  renderer.flush();
+  drawDebug();
+#endif
+}
+
+void WindowCard::drawDebug() {
   g_pHyprOpenGL->renderRect(contentBox, CHyprColor(1.0, 0.0, 0.0, 0.2), {});
   auto text = g_pHyprOpenGL->renderText(std::format("Time: {} ms", std::chrono::duration_cast<std::chrono::milliseconds>(NOW - lastCommit).count()), CHyprColor(1.0, 1.0, 1.0, 1.0), 20);
   g_pHyprOpenGL->renderTexture(text, {contentBox.pos(), text->m_size}, {.a = 1.0});
-#endif
 }
 
-bool WindowCard::snapshot(const Vector2D &targetSize) {
-  LOG_SCOPE(Log::ERR);
+// Client buffers on top of the card, in the same batch. External textures
+// can't be sampled by the card shader, a tree with any of those is drawn
+// the slow way.
+void WindowCard::queueDirect(CardRenderer &renderer, const float alpha) {
+  struct Walk {
+    CardRenderer *renderer;
+    Vector2D scale, origin;
+    CBox clip;
+    float alpha;
+    bool plain = true;
+  } walk{&renderer, previewBox.size() / surfaceSize, previewBox.pos(), previewBox, alpha};
+  const auto resource = window->resource();
+  resource->breadthfirst([](SP<CWLSurfaceResource> s, const Vector2D &, void *data) {
+    const auto &texture = s->m_current.texture;
+    if (texture && (texture->m_type == TEXTURE_EXTERNAL || texture->m_target != GL_TEXTURE_2D))
+      static_cast<Walk *>(data)->plain = false;
+  },
+                         &walk);
+  if (!walk.plain) {
+    renderer.flush();
+    drawDirect(alpha);
+    return;
+  }
+
+  resource->breadthfirst([](SP<CWLSurfaceResource> s, const Vector2D &offset, void *data) {
+    const auto &walk = *static_cast<Walk *>(data);
+    const auto &texture = s->m_current.texture;
+    if (!texture)
+      return;
+    auto box = s->extends();
+    box.scale(walk.scale).translate(offset * walk.scale + walk.origin);
+    walk.renderer->add(CardRenderer::Surface{texture, box, walk.clip, texture->m_type == TEXTURE_RGBX, walk.alpha});
+  },
+                         &walk);
+}
+
+// Runs every frame: the clip region is kept around and the walk gets its
+// state through data, a capturing lambda wouldn't fit in std::function inline.
+void WindowCard::drawDirect(const float alpha) {
+  // subsurfaces can stick out of the window, keep them inside the card
+  directClip.set(g_pHyprOpenGL->m_renderData.damage).intersect(previewBox);
+  struct Walk {
+    Vector2D scale, origin;
+    const CRegion *clip;
+    float alpha;
+  } walk{previewBox.size() / surfaceSize, previewBox.pos(), &directClip, alpha};
+  window->resource()->breadthfirst([](SP<CWLSurfaceResource> s, const Vector2D &offset, void *data) {
+    const auto &walk = *static_cast<Walk *>(data);
+    if (!s->m_current.texture)
+      return;
+    auto box = s->extends();
+    box.scale(walk.scale).translate(offset * walk.scale + walk.origin);
+    g_pHyprOpenGL->renderTexture(s->m_current.texture, box, {.damage = walk.clip, .a = walk.alpha});
+  },
+                                   &walk);
+}
+
+// Sets the card up with a back slot fitting the surface inside targetSize.
+// The actual capture happens batched in PreviewAtlas::snapshot().
+bool WindowCard::prepareSnapshot(const Vector2D &maxSize) {
   if (!window || !window->wlSurface() || !window->wlSurface()->resource()) {
     LOG(ERR, "No window or surface");
     return false;
   }
+  // Content changed anyway, so this is also where a card that moved back shrinks.
+  const Vector2D targetSize = maxSize / (double)(1 << wantedLod);
   if (targetSize.x <= 1 || targetSize.y <= 1) {
     LOG(ERR, "targetSize.x ({}) <= 1 || targetSize.y ({}) <= 1", targetSize.x, targetSize.y);
     return false;
   }
 
-  if (targetSize.x <= 1 || targetSize.y <= 1)
-    return false;
-
   const auto resource = window->wlSurface()->resource();
-  if (!resource->m_current.updated.all && !firstSnapshot)
-    return false;
-  if (firstSnapshot)
-    firstSnapshot = false;
 
-  const auto MONITOR = Desktop::focusState()->monitor();
-  auto surfaceSize = window->wlSurface()->getSurfaceBoxGlobal().value_or({0, 0, 0, 0}).size();
-  CRegion fakeDamage = CBox{{0, 0}, targetSize};
+  // Pick up subsurfaces that appeared since the listeners were attached.
+  size_t surfaces = 0;
+  resource->breadthfirst([&](SP<CWLSurfaceResource> s, const Vector2D &offset, void *) { surfaces++; }, nullptr);
+  if (surfaces != commit.size()) {
+    attachListeners(resource);
+    fullDamage = true;
+  }
 
+  auto surfaceSize = window->wlSurface()->getSurfaceBoxGlobal().value_or({0, 0, 0, 0}).size();
   if (surfaceSize.x < 1.0 || surfaceSize.y < 1.0) {
     Log::logger->log(Log::ERR, "[{}] WindowSnapshot::update, invalid surface size: {}", PLUGIN_NAME, surfaceSize);
     return false;
   }
 
-  if (targetSize > fb.m_size) {
-    fb.alloc(targetSize.x, targetSize.y, MONITOR->m_output->state->state().drmFormat);
-  }
+  snapshotScale = std::min(targetSize.x / surfaceSize.x, targetSize.y / surfaceSize.y);
+  const Vector2D slotSize = (surfaceSize * snapshotScale).round();
 
-  g_pHyprRenderer->makeEGLCurrent();
-
-  if (!g_pHyprRenderer->beginRender(MONITOR, fakeDamage, RENDER_MODE_FULL_FAKE, nullptr, &fb)) {
+  // Captures go to a back slot, the card is drawn from the front one until
+  // the capture has landed, see finishSnapshot().
+  auto &atlas = manager->atlas;
+  const auto format = atlas.formatFor(wantedLod);
+  releaseBack();
+  back = atlas.allocate(slotSize, format);
+  // over the VRAM budget, make room from previews nobody looked at in a while
+  while (!back && manager->evictPreview(this))
+    back = atlas.allocate(slotSize, format);
+  if (!back)
     return false;
+  backLod = wantedLod;
+
+  // With a front slot just like it only the damage has to be drawn, the rest
+  // is copied over.
+  if (captured && slot && atlas.valid(*slot) && slot->box.size() == back->box.size() && atlas.formatOf(*slot) == format)
+    copyFrom = slot;
+
+  pendingSeq = commitSeq;
+  snapshotDamage.clear();
+  if (!copyFrom || fullDamage) {
+    copyFrom.reset();
+    snapshotDamage.add(back->box);
+  } else {
+    resource->breadthfirst([&](SP<CWLSurfaceResource> s, const Vector2D &offset, void *) {
+      const auto it = damage.find(s.get());
+      if (it == damage.end())
+        return;
+      CRegion dmg = it->second;
+      dmg.translate(offset).scale(snapshotScale).translate(back->box.pos());
+      snapshotDamage.add(dmg);
+    },
+                           nullptr);
+    // a pixel or two around it for the filtering when scaling down
+    snapshotDamage.expand(2).intersect(back->box);
   }
 
-  g_pHyprOpenGL->clear(CHyprColor{0, 0, 0, 1.0f});
+  if (snapshotDamage.empty()) {
+    // damage was on a surface that's gone, nothing visible changed
+    snapshotSeq = pendingSeq;
+    damage.clear();
+    releaseBack();
+    return false;
+  }
+  return true;
+}
 
-  const double scale = std::min(fb.m_size.x / surfaceSize.x, fb.m_size.y / surfaceSize.y);
-  g_pHyprRenderer->m_bBlockSurfaceFeedback = true;
+// Called inside the atlas render pass for the back slot's page. The pass
+// damage covers every card in the batch, so draws are clipped to this card's
+// own snapshotDamage (inside its slot): subsurfaces sticking out of the window
+// would paint over the neighbouring slots otherwise.
+void WindowCard::renderSnapshot() {
+  const auto resource = window->wlSurface()->resource();
+  const auto origin = back->box.pos();
   resource->breadthfirst([&](SP<CWLSurfaceResource> s, const Vector2D &offset, void *) {
     if (!s->m_current.texture)
       return;
     auto box = s->extends();
-    box.scale(scale).translate(offset * scale);
-    g_pHyprOpenGL->renderTexture(s->m_current.texture, box, {.a = 1.0f});
+    box.scale(snapshotScale).translate(offset * snapshotScale + origin);
+    g_pHyprOpenGL->renderTexture(s->m_current.texture, box, {.damage = &snapshotDamage, .a = 1.0f});
   },
                          nullptr);
 
-  g_pHyprRenderer->m_bBlockSurfaceFeedback = false;
-  g_pHyprRenderer->endRender();
+  // later commits go in the next capture
+  inflight = true;
+  fullDamage = false;
+  damage.clear();
+}
+
+// After the atlas pass, the card swaps slots once the GPU got through it.
+void WindowCard::fenceSnapshot() {
+  manager->worker.track(this, *back, pendingSeq, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+}
+
+bool WindowCard::queueSnapshot(SnapshotWorker &worker) {
+  auto &atlas = manager->atlas;
+  const auto page = atlas.texture(*back);
+  const auto from = copyFrom ? atlas.texture(*copyFrom) : nullptr;
+  if (!page || (copyFrom && !from))
+    return false;
+
+  // The worker only samples plain 2D textures, external ones stay here.
+  bool plain = true;
+  SnapshotWorker::Capture capture{
+      .page = page->m_texID,
+      .pageSize = atlas.size(),
+      .box = back->box,
+      .from = from ? from->m_texID : 0,
+      .fromBox = copyFrom ? copyFrom->box : CBox{},
+      .clip = snapshotDamage.getExtents(),
+  };
+  std::vector<SP<CTexture>> textures;
+  const auto resource = window->wlSurface()->resource();
+  const auto origin = back->box.pos();
+  resource->breadthfirst([&](SP<CWLSurfaceResource> s, const Vector2D &offset, void *) {
+    const auto &texture = s->m_current.texture;
+    if (!texture)
+      return;
+    if (texture->m_type == TEXTURE_EXTERNAL || texture->m_target != GL_TEXTURE_2D) {
+      plain = false;
+      return;
+    }
+    auto box = s->extends();
+    box.scale(snapshotScale).translate(offset * snapshotScale + origin);
+    capture.draws.emplace_back(SnapshotWorker::Draw{texture->m_texID, texture->m_type == TEXTURE_RGBX, box});
+    textures.emplace_back(texture);
+  },
+                         nullptr);
+  if (!plain || !worker.submit(this, *back, pendingSeq, std::move(capture), std::move(textures)))
+    return false;
+
+  // Whatever is committed from here on goes in the next capture.
+  inflight = true;
+  fullDamage = false;
+  damage.clear();
+  return true;
+}
+
+bool WindowCard::finishSnapshot(const AtlasSlot &target, uint64_t seq, bool ok) {
+  inflight = false;
+  const bool same = back && back->page == target.page && back->box == target.box && back->generation == target.generation;
+  if (!ok || !same) {
+    if (same)
+      releaseBack();
+    // the damage went with the capture, start over
+    fullDamage = true;
+    return false;
+  }
+
+  // swap, the old front goes back to the atlas
+  if (slot && manager)
+    manager->atlas.release(*slot);
+  slot = back;
+  back.reset();
+  copyFrom.reset();
+  lod = backLod;
   lastSnapshot = NOW;
-  ready = true;
+  captured = true;
+  snapshotSeq = seq;
   return true;
 }
 
-void WindowCard::drawTitle(const CBox &box, const float scale, const float alpha) {
+void WindowCard::updateTitle(const CBox &box, const float scale) {
   float baseWidth = box.width / scale;
   float padding = 10.0f;
 
-  if (window->m_title != title) {
+  // in steps of 16px so a card growing a little doesn't lay the title out again
+  const int maxWidth = std::max(0, (int)(baseWidth - padding)) / 16 * 16;
+  const bool stale = titleSlot && !manager->titles.valid(*titleSlot);
+  // far away cards keep the placeholder, no point laying out hundreds of titles
+  if (resident && (window->m_title != title || maxWidth != titleWidth || titlePending || stale)) {
     title = window->m_title;
-    int maxChars = std::max(5.0f, (float)((baseWidth - padding) / (Config::fontSize * 0.55f)));
-    std::string displayTitle = middleTruncate(title, maxChars);
-    titleTexture = g_pHyprOpenGL->renderText(displayTitle, CHyprColor(1.0, 1.0, 1.0, 1.0), Config::fontSize);
+    titleWidth = maxWidth;
+    // Rasterized off-thread, keep showing the old one until the new one is in.
+    const auto slot = manager->titles.get(title, maxWidth);
+    titlePending = !slot;
+    if (slot || stale)
+      titleSlot = slot;
+  }
+
+  if (titleSlot) {
+    const Vector2D size = titleSlot->box.size() * scale / TitleCache::oversample();
+    textBox = {titleBox.pos() + (titleBox.size() - size) * 0.5f, size};
   }
+}
+
+bool WindowCard::titleOutdated() const {
+  return titlePending || (titleSlot && !manager->titles.valid(*titleSlot));
+}
 
+void WindowCard::markShown() {
+  lastShown = NOW;
+  if (titleSlot)
+    manager->titles.use(*titleSlot);
+}
+
+void WindowCard::drawTitle(const float alpha) {
   g_pHyprOpenGL->renderRect(titleBox, CHyprColor(0.0, 0.0, 0.0, 0.8 * alpha), {});
 
-  if (!titleTexture)
+  const auto texture = manager->titles.texture();
+  if (!titleSlot) {
+    // placeholder where the text will go
+    const CBox bar = {titleBox.x + titleBox.width * 0.3, titleBox.y + titleBox.height * 0.35, titleBox.width * 0.4, titleBox.height * 0.3};
+    g_pHyprOpenGL->renderRect(bar, CHyprColor(1.0, 1.0, 1.0, 0.15 * alpha), {});
+    return;
+  }
+  if (!texture || titleSlot->box.empty())
     return;
 
-  Vector2D dSize = titleTexture->m_size * scale;
-  Vector2D dPos = titleBox.pos() + (titleBox.size() - dSize) * 0.5f;
-  g_pHyprOpenGL->renderTexture(titleTexture, {dPos, dSize}, {.a = alpha});
+  const auto [uvTL, uvBR] = manager->titles.uv(*titleSlot);
+  g_pHyprOpenGL->m_renderData.primarySurfaceUVTopLeft = uvTL;
+  g_pHyprOpenGL->m_renderData.primarySurfaceUVBottomRight = uvBR;
+  g_pHyprOpenGL->renderTexture(texture, textBox, {.a = alpha, .allowCustomUV = true});
+  g_pHyprOpenGL->m_renderData.primarySurfaceUVTopLeft = Vector2D(-1, -1);
+  g_pHyprOpenGL->m_renderData.primarySurfaceUVBottomRight = Vector2D(-1, -1);
+}
+
+void WindowCard::drawBorder(const float alpha, const bool active) {
+  g_pHyprOpenGL->renderBorder(contentBox, active ? *Config::activeBorderColor : *Config::inactiveBorderColor, {.round = (int)Config::borderRounding, .roundingPower = Config::borderRoundingPower, .borderSize = (int)Config::borderSize, .a = alpha});
+}
+
+SP<WindowCard> CardPool::get(PHLWINDOW window) {
+  auto it = cards.find(window);
+  if (it != cards.end())
+    return it->second;
+  auto card = makeShared<WindowCard>(window);
+  cards.emplace(window, card);
+  return card;
+}
+
+void CardPool::evict(PHLWINDOW window) {
+  cards.erase(window);
+}
+
+void CardPool::clear() {
+  cards.clear();
 }
 
-void WindowCard::drawBorder(const float alpha) {
-  g_pHyprOpenGL->renderBorder(contentBox, isActive ? *Config::activeBorderColor : *Config::inactiveBorderColor, {.round = (int)Config::borderRounding, .roundingPower = Config::borderRoundingPower, .borderSize = (int)Config::borderSize, .a = alpha});
+size_t CardPool::size() const {
+  return cards.size();
 }
@@ -1,43 +1,140 @@
 #pragma once
 
 #include "animvar.hpp"
+#include "atlas.hpp"
 #include "defines.hpp"
+#include "titles.hpp"
 #include <hyprutils/math/Region.hpp>
 #include <hyprutils/math/Vector2D.hpp>
 #include <hyprutils/signal/Listener.hpp>
 #include <src/config/ConfigDataValues.hpp>
 #include <src/helpers/time/Time.hpp>
 #include <src/protocols/core/Compositor.hpp>
-#define private public
-#include <src/render/Framebuffer.hpp>
-#undef private
 #include <src/render/Texture.hpp>
+#include <unordered_map>
+
+class CardRenderer;
+class SnapshotWorker;
 
 class WindowCard {
 public:
   WindowCard(PHLWINDOW window);
   ~WindowCard();
   void requestFrame(PHLMONITOR monitor);
-  bool snapshot(const Vector2D &targetSize);
-  void draw(const CBox &box, const float scale, const float alpha);
-  void drawTitle(const CBox &box, const float scale, const float alpha);
-  void drawBorder(const float alpha);
+  // maxSize is the largest the card is ever drawn at, LOD levels halve it.
+  bool prepareSnapshot(const Vector2D &maxSize);
+  void renderSnapshot();
+  void fenceSnapshot();
+  // Hands the capture prepared by prepareSnapshot() to the snapshot worker.
+  // False if it has to be rendered here after all.
+  bool queueSnapshot(SnapshotWorker &worker);
+  // The worker is done with a capture of slot as of seq. False if it's of
+  // no use anymore (failed, or the card moved to another slot meanwhile).
+  bool finishSnapshot(const AtlasSlot &target, uint64_t seq, bool ok);
+  void draw(const CBox &box, const float scale, const float alpha, const bool active);
+  // Same as draw(), through the batched renderer.
+  void queue(CardRenderer &renderer, const CBox &box, const float scale, const float alpha, const bool active);
+  void drawTitle(const float alpha);
+  void drawBorder(const float alpha, const bool active);
   void attachListeners(SP<CWLSurfaceResource> surface);
 
+  bool dirty() const;
+  // Gives the atlas slot back, the next snapshot starts from scratch.
+  void dropSnapshot();
+  void updateMode();
+  bool takeCommits();
+  // The title has to be redrawn once it arrives or moved in the title page.
+  bool titleOutdated() const;
+  // Drawn this tick, keeps its title from being evicted.
+  void markShown();
+
+  struct Boxes {
+    CBox content, title, preview;
+  };
+  // Where the parts of a card drawn into box end up.
+  static Boxes boxes(const CBox &box, const float scale);
+  // Takes or gives back everything heavy: listeners, snapshot and title.
+  void setResident(bool yes);
+  void refreshSize();
+
   PHLWINDOW window;
-  CFramebuffer fb;
-  bool ready = false;
-  Timestamp lastCommit, lastSnapshot;
+  // The capture that's drawn.
+  std::optional<AtlasSlot> slot;
+  // Where the next capture goes while the front is still drawn, and the
+  // front slot to copy the undamaged parts from.
+  std::optional<AtlasSlot> back, copyFrom;
+  // Page-space region of the back slot to re-render, filled by prepareSnapshot().
+  CRegion snapshotDamage;
+  bool captured = false;
+  Timestamp lastCommit, lastSnapshot, lastShown;
+  // Logical size of the root surface, kept up to date from commits.
+  Vector2D surfaceSize;
   float z = 0.0f;
-  bool isActive = false;
+  // waiting on the title worker
+  bool titlePending = false;
+  // Drawn straight from the client's buffers instead of the atlas.
+  bool direct = false;
+  // Close enough to the selection to hold resources. Everything else is just
+  // a placeholder in the layout.
+  bool resident = false;
+  // set by the rows each tick, see Manager::update()
+  bool wantResident = false;
+  // a capture is with the snapshot worker
+  bool inflight = false;
+  // Index into Manager::wanted this tick, -1 when not asked for.
+  int queued = -1;
+  // Detail level the card needs where it currently sits, 0 is full size.
+  // Shared cards take the sharpest any row asks for.
+  int wantedLod = 0;
+  static constexpr int MAX_LOD = 3;
 
 private:
+  bool place(const CBox &box, const float scale);
+  void updateTitle(const CBox &box, const float scale);
+  void drawDirect(const float alpha);
+  void queueDirect(CardRenderer &renderer, const float alpha);
+  void drawDebug();
+  void releaseBack();
+
   CBox contentBox;
   CBox titleBox;
   CBox previewBox;
+  // where the title text goes inside titleBox
+  CBox textBox;
   std::string title;
-  SP<CTexture> titleTexture;
-  double lastWidth = 0;
+  std::optional<TitleSlot> titleSlot;
+  int titleWidth = -1;
   std::vector<CHyprSignalListener> commit;
-  bool firstSnapshot = true;
+  double snapshotScale = 1.0;
+  // level the current capture was taken at, and the one in the back slot
+  int lod = MAX_LOD + 1;
+  int backLod = 0;
+  // drawDirect()'s scratch, reused so drawing doesn't allocate
+  CRegion directClip;
+  // Surface-local damage per surface in the tree since the last capture.
+  std::unordered_map<CWLSurfaceResource *, CRegion> damage;
+  bool fullDamage = true;
+  uint64_t commitSeq = 1;
+  uint64_t snapshotSeq = 0;
+  uint64_t pendingSeq = 0;
+};
+
+// Cards outlive a single activation so their framebuffers and last snapshot
+// can be reused on the next alt-tab. Evicted when the window closes.
+// Without split_monitor every row shows the same windows and shares one pool,
+// so each window has a single card, slot and set of listeners.
+class CardPool {
+public:
+  SP<WindowCard> get(PHLWINDOW window);
+  void evict(PHLWINDOW window);
+  void clear();
+  size_t size() const;
+  template <typename F>
+  void forEach(F &&fn) const {
+    for (const auto &[w, card] : cards)
+      fn(card.get());
+  }
+
+private:
+  std::unordered_map<PHLWINDOW, SP<WindowCard>> cards;
 };
@@ -32,6 +32,8 @@ enum class Direction : uint8_t {
   X(INT, blurBG, "blur", 1)                                        \
   X(FLOAT, unfocusedAlpha, "unfocused_alpha", 0.6f)                \
   X(INT, powersave, "powersave", 1)                                \
+  X(INT, blurCache, "blur_cache", 1)                               \
+  X(FLOAT, blurRate, "blur_rate", 0.0f)                            \
   X(FLOAT, rotationSpeed, "animation_speed", 1.0f)                 \
   X(FLOAT, carouselSize, "carousel_size", 0.5f)                    \
   X(FLOAT, windowSize, "window_size", 0.3f)                        \
@@ -44,6 +46,13 @@ enum class Direction : uint8_t {
   X(FLOAT, monitorSpacing, "monitor_spacing", 0.3f)                \
   X(FLOAT, monitorAnimationSpeed, "monitor_animation_speed", 0.4f) \
   X(INT, grace, "grace", 100)                                      \
+  X(INT, prewarm, "prewarm", 8)                                    \
+  X(FLOAT, snapshotBudget, "snapshot_budget", 2.0f)                \
+  X(INT, directPreviews, "direct_previews", 1)                     \
+  X(INT, vramBudget, "vram_budget", 512)                           \
+  X(INT, compactPreviews, "compact_previews", 0)                   \
+  X(INT, residentCards, "resident_cards", 24)                      \
+  X(INT, asyncSnapshots, "async_snapshots", 0)                     \
   X(INT, includeSpecial, "include_special", 1)                     \
   X(STRING, style, "style", "carousel")
 
@@ -1,16 +1,12 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstddef>
+#include <optional>
 #include <string>
-inline std::string middleTruncate(std::string str, size_t maxLen = 40) {
-  if (str.length() <= maxLen)
-    return str;
-  maxLen = std::max((int)maxLen, 5);
-
-  size_t sideLen = (maxLen - 3) / 2;
-  return str.substr(0, sideLen) + "..." + str.substr(str.length() - sideLen);
-}
+#include <utility>
 
 inline std::string toLower(std::string_view str) {
   std::string out(str);
@@ -18,3 +14,34 @@ inline std::string toLower(std::string_view str) {
                  [](unsigned char c) { return std::tolower(c); });
   return out;
 }
+
+// Single producer, single consumer ring. No locks, each side only ever
+// writes its own index.
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  bool push(T &&value) {
+    const auto h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N)
+      return false;
+    items[h & (N - 1)] = std::move(value);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> pop() {
+    const auto t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return std::nullopt;
+    T value = std::move(items[t & (N - 1)]);
+    tail.store(t + 1, std::memory_order_release);
+    return value;
+  }
+
+private:
+  alignas(64) std::atomic<size_t> head = 0;
+  alignas(64) std::atomic<size_t> tail = 0;
+  std::array<T, N> items;
+};
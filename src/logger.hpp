@@ -2,6 +2,8 @@
 
 #include "defines.hpp"
 #include <chrono>
+#include <format>
+#include <iterator>
 #include <src/debug/log/Logger.hpp>
 #include <src/desktop/DesktopTypes.hpp>
 
@@ -83,6 +85,13 @@ private:
 class DebugText {
 public:
   void add(const std::string &text);
+  // formats straight into the buffer, no temporary string per line
+  template <typename... Args>
+  void add(std::format_string<Args...> fmt, Args &&...args) {
+    if (!m_sBuffer.empty())
+      m_sBuffer += '\n';
+    std::format_to(std::back_inserter(m_sBuffer), fmt, std::forward<Args>(args)...);
+  }
   void draw(PHLMONITOR monitor);
 
 private:
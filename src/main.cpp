@@ -178,6 +178,10 @@ APICALL EXPORT PLUGIN_DESCRIPTION_INFO PLUGIN_INIT(HANDLE handle) {
 
   registerConfig();
 
+  HyprlandAPI::registerHyprCtlCommand(PHANDLE, SHyprCtlCommand{.name = "alttabstats", .exact = true, .fn = [](eHyprCtlOutputFormat format, std::string request) -> std::string {
+                                        return manager->statsString();
+                                      }});
+
   try {
     auto keyhooklookup = HyprlandAPI::findFunctionsByName(PHANDLE, "onKeyEvent");
     if (keyhooklookup.size() != 1) {
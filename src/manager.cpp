@@ -1,4 +1,5 @@
 #include "manager.hpp"
+#include "alloc.hpp"
 #include "defines.hpp"
 #include "helpers.hpp"
 #include <aquamarine/output/Output.hpp>
@@ -7,6 +8,7 @@
 #include <src/Compositor.hpp>
 #include <src/desktop/history/WindowHistoryTracker.hpp>
 #include <src/desktop/state/FocusState.hpp>
+#include <src/desktop/view/LayerSurface.hpp>
 #include <src/helpers/Color.hpp>
 #include <src/helpers/Monitor.hpp>
 #include <src/managers/eventLoop/EventLoopManager.hpp>
@@ -31,10 +33,11 @@ Manager::Manager() {
   listeners.config = HyprlandAPI::registerCallbackDynamic(PHANDLE, "configReloaded", [this](void *self, SCallbackInfo &info, std::any data) { onConfigReload(); });
   listeners.windowCreated = HyprlandAPI::registerCallbackDynamic(PHANDLE, "openWindow", [this](void *self, SCallbackInfo &info, std::any data) { onWindowCreated(std::any_cast<PHLWINDOW>(data)); });
   listeners.windowDestroyed = HyprlandAPI::registerCallbackDynamic(PHANDLE, "closeWindow", [this](void *self, SCallbackInfo &info, std::any data) { onWindowDestroyed(std::any_cast<PHLWINDOW>(data)); });
-  listeners.render = HyprlandAPI::registerCallbackDynamic(PHANDLE, "render", [this](void *self, SCallbackInfo &info, std::any data) { onRender(std::any_cast<eRenderStage>(data)); });
+  listeners.windowFocused = HyprlandAPI::registerCallbackDynamic(PHANDLE, "activeWindow", [this](void *self, SCallbackInfo &info, std::any data) { onWindowFocused(std::any_cast<PHLWINDOW>(data)); });
+  listeners.windowMoved = HyprlandAPI::registerCallbackDynamic(PHANDLE, "moveWindow", [this](void *self, SCallbackInfo &info, std::any data) { onWindowMoved(std::any_cast<PHLWINDOW>(std::any_cast<std::vector<std::any>>(data)[0])); });
   listeners.focusChange = HyprlandAPI::registerCallbackDynamic(PHANDLE, "monitorFocusChange", [this](void *self, SCallbackInfo &info, std::any data) { onFocusChange(std::any_cast<PHLMONITOR>(data)); });
-  listeners.monitorAdded = HyprlandAPI::registerCallbackDynamic(PHANDLE, "monitorAdded", [this](void *self, SCallbackInfo &info, std::any data) { rebuild(); });
-  listeners.monitorRemoved = HyprlandAPI::registerCallbackDynamic(PHANDLE, "monitorRemoved", [this](void *self, SCallbackInfo &info, std::any data) { rebuild(); });
+  listeners.monitorAdded = HyprlandAPI::registerCallbackDynamic(PHANDLE, "monitorAdded", [this](void *self, SCallbackInfo &info, std::any data) { onMonitorAdded(std::any_cast<PHLMONITOR>(data)); });
+  listeners.monitorRemoved = HyprlandAPI::registerCallbackDynamic(PHANDLE, "monitorRemoved", [this](void *self, SCallbackInfo &info, std::any data) { onMonitorRemoved(std::any_cast<PHLMONITOR>(data)); });
 #else
   listeners.config = HOOK_EVENT(config.reloaded, [this]() {
     onConfigReload();
@@ -45,21 +48,96 @@ Manager::Manager() {
   listeners.windowDestroyed = HOOK_EVENT(window.close, [this](auto w) {
     onWindowDestroyed(w);
   });
-  listeners.render = HOOK_EVENT(render.stage, [this](auto s) {
-    onRender(s);
+  listeners.windowFocused = HOOK_EVENT(window.active, [this](auto w, auto &&...) {
+    onWindowFocused(w);
+  });
+  listeners.windowMoved = HOOK_EVENT(window.moveToWorkspace, [this](auto w, auto &&...) {
+    onWindowMoved(w);
   });
   listeners.focusChange = HOOK_EVENT(monitor.focused, [this](auto m) {
     onFocusChange(m);
   });
   listeners.monitorAdded = HOOK_EVENT(monitor.added, [this](auto m) {
-    rebuild();
+    onMonitorAdded(m);
   });
   listeners.monitorRemoved = HOOK_EVENT(monitor.removed, [this](auto m) {
-    rebuild();
+    onMonitorRemoved(m);
   });
 #endif
 
   lastFrame = lastUpdate = NOW;
+
+  for (const auto &ref : Desktop::History::windowTracker()->fullHistory()) {
+    if (auto w = ref.lock())
+      touch(w);
+  }
+  // monitors are picked up by reconcile() on first open, manager isn't set yet
+}
+
+// Only hooked while the carousel is shown, so a closed switcher costs nothing per frame.
+void Manager::hookRender() {
+  if (listeners.render)
+    return;
+#ifdef HYPRLAND_LEGACY
+  listeners.render = HyprlandAPI::registerCallbackDynamic(PHANDLE, "render", [this](void *self, SCallbackInfo &info, std::any data) { onRender(std::any_cast<eRenderStage>(data)); });
+  listeners.preRender = HyprlandAPI::registerCallbackDynamic(PHANDLE, "preRender", [this](void *self, SCallbackInfo &info, std::any data) { onPreRender(std::any_cast<PHLMONITOR>(data)); });
+#else
+  listeners.render = HOOK_EVENT(render.stage, [this](auto s) {
+    onRender(s);
+  });
+  listeners.preRender = HOOK_EVENT(render.pre, [this](auto m) {
+    onPreRender(m);
+  });
+#endif
+}
+
+void Manager::unhookRender() {
+  listeners.render.reset();
+  listeners.preRender.reset();
+}
+
+void Manager::count(uint64_t &counter) {
+  counter++;
+  if (!active)
+    stats.idle++;
+}
+
+std::string Manager::statsString() const {
+  size_t resident = 0;
+  for (const auto &[id, pool] : pools)
+    pool.forEach([&](WindowCard *card) { resident += card->resident; });
+  return std::format("active: {}\nframes: {}\nticks: {}\nsnapshots: {}\nbackgrounds: {}\nidle: {}\nframe allocations: {}\ncards: {} ({} resident)\nvram: {} KiB (previews {} KiB, backgrounds {} KiB)\n",
+                     active, stats.frames, stats.ticks, stats.snapshots, stats.backgrounds, stats.idle, stats.frameAllocations, mru.size(), resident,
+                     (atlas.bytes() + backdrops.bytes()) >> 10, atlas.bytes() >> 10, backdrops.bytes() >> 10);
+}
+
+bool Manager::evictPreview(const WindowCard *except) {
+  WindowCard *oldest = nullptr;
+  for (const auto &[id, pool] : pools) {
+    pool.forEach([&](WindowCard *card) {
+      // anything seen this tick is on screen
+      if (card == except || !card->slot || card->lastShown >= lastFrame)
+        return;
+      if (!oldest || card->lastShown < oldest->lastShown)
+        oldest = card;
+    });
+  }
+  if (!oldest)
+    return false;
+  oldest->dropSnapshot();
+  return true;
+}
+
+// vram_budget covers previews and backgrounds, backgrounds get at most half.
+void Manager::applyBudget() {
+  if (Config::vramBudget <= 0) {
+    atlas.setLimit(SIZE_MAX);
+    return;
+  }
+  const size_t budget = (size_t)Config::vramBudget << 20;
+  backdrops.trim(budget / 2);
+  const auto used = backdrops.bytes();
+  atlas.setLimit(budget > used ? budget - used : 0);
 }
 
 void Manager::damageMonitors() {
@@ -71,6 +149,13 @@ void Manager::damageMonitors() {
 void Manager::activate() {
   LOG_SCOPE()
   active = true;
+  prepared = false;
+  warmed = {};
+  // Build everything during the grace period, the first visible frame then
+  // already has backgrounds and sharp previews. It's done in steps so a quick
+  // alt-tab, released before the grace period is up, stops paying early.
+  ++sessionId;
+  scheduleWarmup();
   graceTimer = makeShared<CEventLoopTimer>(std::chrono::milliseconds(Config::grace), [this](SP<CEventLoopTimer> timer, void *data) { this->init(); }, nullptr);
   g_pEventLoopManager->addTimer(graceTimer);
   // g_pHyprRenderer->damageMonitor(Desktop::focusState()->monitor());
@@ -88,32 +173,233 @@ bool Manager::setLayout() {
   } else {
     layoutStyle = makeShared<Carousel>();
   }
+  layoutSerial++;
   return (layoutStyle != nullptr);
 }
 
+// A step of warmup() per timer. doLater() would run every step in the same
+// idle pass, timers let the key release in between.
+void Manager::scheduleWarmup() {
+  warmupTimer = makeShared<CEventLoopTimer>(std::chrono::milliseconds(1), [this, session = sessionId](SP<CEventLoopTimer> timer, void *data) {
+    if (active && !initialized && session == sessionId && warmup(1))
+      scheduleWarmup();
+  }, nullptr);
+  g_pEventLoopManager->addTimer(warmupTimer);
+}
+
+// Captures at most this many previews per warmup step.
+static constexpr size_t WARMUP_CAPTURES = 2;
+
+// Builds what the first frame needs: prepare(), a backdrop per monitor, then
+// up to prewarm previews a few at a time. Does at most steps of those and
+// returns whether there's more to do.
+bool Manager::warmup(size_t steps) {
+  LOG_SCOPE()
+  if (!prepared) {
+    // Nothing watched the screen while the switcher was closed, so whatever
+    // the monitors show now is captured again instead of trusting the cache,
+    // and the rest isn't worth holding on to.
+    backdrops.dropHidden();
+    for (const auto &m : g_pCompositor->m_monitors) {
+      if (m->m_activeWorkspace)
+        backdrops.invalidate(m->m_activeWorkspace->m_id);
+    }
+    prepare();
+    prepared = true;
+    if (--steps == 0)
+      return true;
+  }
+
+  while (warmed.backdrops < monitors.size()) {
+    const auto &mon = std::next(monitors.begin(), warmed.backdrops++)->second;
+    // Reopened within blur_rate, the old blur is shown until refreshBackdrops() gets to it.
+    mon->createTexture(cachedBlur() && !blurDue(mon->monitor));
+    g_pHyprRenderer->damageMonitor(mon->monitor);
+    if (--steps == 0)
+      return true;
+  }
+
+  const auto MONITOR = Desktop::focusState()->monitor();
+  if (!MONITOR || !monitors.contains(activeMonitor) || !atlas.configure(MONITOR))
+    return false;
+
+  const auto &mon = monitors[activeMonitor];
+  const Vector2D mSize = MONITOR->m_size * MONITOR->m_scale;
+  const auto more = [&] { return warmed.cards < mon->windows.size() && warmed.captures < (size_t)Config::prewarm; };
+  while (more()) {
+    batch.clear();
+    while (more() && batch.size() < WARMUP_CAPTURES) {
+      const auto &card = mon->windows[warmed.cards++];
+      card->setResident(true);
+      card->requestFrame(MONITOR);
+      if (card->dirty() && card->prepareSnapshot(Monitor::snapshotSize(mSize))) {
+        batch.emplace_back(card.get());
+        warmed.captures++;
+      }
+    }
+    if (!batch.empty()) {
+      // counted once they land, see update()
+      const auto start = NOW;
+      atlas.snapshot(MONITOR, batch);
+      scheduler.spend(batch.size(), NOW - start);
+    }
+    if (--steps == 0)
+      return more();
+  }
+  return false;
+}
+
 void Manager::init() {
-  activeMonitor = Desktop::focusState()->monitor()->m_id;
   monitorFade.set(1.0f, false);
-  rebuild();
-  loopTimer = makeShared<CEventLoopTimer>(std::chrono::milliseconds(10), [this](SP<CEventLoopTimer> timer, void *data) {
-    auto d = FloatTime(NOW - lastFrame).count();
-    auto min = std::min(d, (monitors[activeMonitor]->monitor->m_refreshRate * 2) / 1000);
-    update(min);
+  if (prepared) {
+    // windows may have come or gone since warmup() started
+    for (auto &[id, mon] : monitors)
+      mon->activeChanged();
+  }
+  // whatever the grace period didn't get to
+  warmup(SIZE_MAX);
+  if (warmupTimer) {
+    warmupTimer->cancel();
+    warmupTimer.reset();
+  }
+  initialized = true;
+  sleeping = true;
+  hookRender();
+  watchBackdrops();
+  damageMonitors();
+  wake();
+}
+
+// Ticks are driven by the focused monitor's own frames, so animations run at
+// its real refresh rate and stay in step with vblank. Damaging it schedules
+// the next tick; once nothing moves anymore we stop and sleep until wake().
+void Manager::tick() {
+  const auto MONITOR = Desktop::focusState()->monitor();
+  // at most two refreshes worth, so a stall doesn't make everything jump
+  const float maxDelta = 2.0f / std::max(1.0f, MONITOR->m_refreshRate);
+  const float delta = std::min(FloatTime(NOW - lastFrame).count(), maxDelta);
+  lastFrame = NOW;
+
+  applyBudget();
+  titlesArrived = titles.poll();
+  sleeping = !update(delta) && !titles.pending();
+  if (refreshBackdrops())
+    sleeping = false;
+
+  // Rows sliding or fading move everything. Otherwise only the cards that
+  // changed are repainted: without split_monitor only the focused row is
+  // drawn, at offset 0, with it every row is shifted like in draw().
+  if (!monitorFade.done() || !monitorOffset.done())
+    g_pHyprRenderer->damageMonitor(MONITOR);
+  else if (!Config::splitMonitor) {
+    if (const auto it = monitors.find(MONITOR->m_id); it != monitors.end() && !it->second->damage.empty())
+      MONITOR->addDamage(it->second->damage);
+  } else {
+    const auto spacing = MONITOR->m_size.y * Config::monitorSpacing;
+    int i = 0;
+    for (auto &[id, mon] : monitors) {
+      if (!mon->damage.empty())
+        MONITOR->addDamage(mon->damage.translate({0.0, (i - monitorOffset.current) * spacing}));
+      i++;
+    }
+  }
+  for (auto &[id, mon] : monitors)
+    mon->damage.clear();
+
+  if (!sleeping)
+    g_pCompositor->scheduleFrameForMonitor(MONITOR);
+}
+
+// Without powersave the carousel would otherwise blur the live scene behind it
+// every frame. Instead the backdrop is captured and blurred once, and redone
+// only when something behind it changed.
+bool Manager::cachedBlur() const {
+  return !Config::powersave && Config::blurBG && Config::blurCache;
+}
+
+// Whether blur_rate lets the monitor's backdrop be blurred again yet.
+bool Manager::blurDue(PHLMONITOR monitor) const {
+  return Config::blurRate <= 0.0f || FloatTime(NOW - backdrops.rendered(monitor)).count() >= 1.0f / Config::blurRate;
+}
+
+// Re-blurs stale backdrops, at most blur_rate times a second. Returns whether
+// one is still waiting for its turn so the loop stays awake for it.
+bool Manager::refreshBackdrops() {
+  if (!cachedBlur())
+    return false;
+
+  bool waiting = false;
+  for (auto &[id, mon] : monitors) {
+    if (!backdrops.stale(mon->monitor))
+      continue;
+    if (!blurDue(mon->monitor)) {
+      waiting = true;
+      continue;
+    }
+    mon->createTexture();
+    g_pHyprRenderer->damageMonitor(mon->monitor);
+  }
+  return waiting;
+}
+
+// While the carousel is open, anything committing behind it makes the
+// backdrop stale: layer surfaces (wallpapers, bars) and the windows on the
+// shown workspaces, resident cards or not. What changed while it was closed
+// is caught by warmup() capturing everything fresh.
+void Manager::watchBackdrops() {
+  backdropCommits.clear();
+  if (!cachedBlur())
+    return;
+
+  for (const auto &[id, mon] : monitors) {
+    const auto listen = [this, monitor = PHLMONITORREF(mon->monitor)](SP<CWLSurfaceResource> surface) {
+      backdropCommits.push_back(surface->m_events.commit.listen([this, monitor] {
+        if (const auto m = monitor.lock(); m && m->m_activeWorkspace)
+          backdrops.invalidate(m->m_activeWorkspace->m_id);
+        wake();
+      }));
+    };
+    for (const auto &layer : mon->monitor->m_layerSurfaceLayers) {
+      for (const auto &ref : layer) {
+        const auto ls = ref.lock();
+        if (ls && ls->m_surface && ls->m_surface->resource())
+          listen(ls->m_surface->resource());
+      }
+    }
+    for (const auto &w : g_pCompositor->m_windows) {
+      if (w->m_isMapped && w->resource() && w->m_workspace && w->m_workspace == mon->monitor->m_activeWorkspace)
+        listen(w->resource());
+    }
+  }
+}
+
+// Only schedules a tick, whatever changed gets damaged there.
+void Manager::wake() {
+  if (!initialized)
+    return;
+  if (sleeping) {
+    sleeping = false;
     lastFrame = NOW;
-    loopTimer->updateTimeout(std::chrono::milliseconds(16)); }, nullptr);
-  g_pEventLoopManager->addTimer(loopTimer);
+  }
+  g_pCompositor->scheduleFrameForMonitor(Desktop::focusState()->monitor());
 }
 
 void Manager::deactivate() {
   LOG_SCOPE()
   active = false;
+  initialized = false;
+  prepared = false;
+  unhookRender();
+  backdropCommits.clear();
   graceTimer->cancel();
+  if (warmupTimer)
+    warmupTimer->cancel();
+  warmupTimer.reset();
   for (const auto &[id, mon] : monitors) {
     g_pHyprRenderer->damageMonitor(mon->monitor);
+    mon->reset();
   }
-  loopTimer.reset();
   graceTimer.reset();
-  monitors.clear();
 }
 
 void Manager::toggle() {
@@ -127,7 +413,7 @@ void Manager::toggle() {
 }
 
 void Manager::confirm() {
-  if (!monitors.contains(activeMonitor)) {
+  if (!initialized || !monitors.contains(activeMonitor)) {
     const auto history = Desktop::History::windowTracker()->fullHistory();
     PHLWINDOWREF lastWindow;
     if (history.size() >= 2) {
@@ -155,28 +441,126 @@ void Manager::confirm() {
   deactivate();
 }
 
-void Manager::update(float delta) {
+bool Manager::update(float delta) {
   LOG_SCOPE()
-  const auto MONITOR = Desktop::focusState()->monitor();
+  count(stats.ticks);
   monitorFade.tick(delta, 0.4);
   monitorOffset.tick(delta, Config::monitorAnimationSpeed);
+  scheduler.beginFrame();
+  wanted.clear();
+
+  // Only the focused monitor gets damaged for this (see tick()), others would mess up the animations.
+  bool busy = !monitorOffset.done() || !monitorFade.done();
   for (const auto &[id, m] : monitors) {
     m->update(delta);
-    if (m->animating || !monitorOffset.done()) {
-      // God i'm stupid sometimes. Ofc only damage the active monitor or animations will be fucked.
-      g_pHyprRenderer->damageMonitor(MONITOR);
-    }
+    busy |= m->animating;
+  }
+
+  // Cards that dropped out of every row's window around the selection give
+  // their resources back, the ones that came in pick them up.
+  for (auto &[id, pool] : pools) {
+    pool.forEach([](WindowCard *card) {
+      card->setResident(card->wantResident);
+      card->wantResident = false;
+    });
+  }
+  // captures the GPU finished since the last tick
+  for (const auto card : worker.poll()) {
+    count(stats.snapshots);
+    damageCard(card);
+  }
+  atlas.reap();
+  busy |= worker.pending();
+  busy |= snapshotCards();
+
+  // cards can be gone by the next tick
+  for (const auto &w : wanted)
+    w.card->queued = -1;
+  wanted.clear();
+  return busy;
+}
+
+// A shared card is asked for once per row, it keeps a single entry with the
+// most urgent priority and the sharpest level any row needs.
+void Manager::wantSnapshot(WindowCard *card, float priority, int lod) {
+  if (card->queued >= 0) {
+    auto &w = wanted[card->queued];
+    w.priority = std::max(w.priority, priority);
+    w.lod = std::min(w.lod, lod);
+    return;
   }
+  card->queued = wanted.size();
+  wanted.emplace_back(Wanted{card, priority, lod});
+}
+
+// Captures the most urgent of the cards the rows asked for, within the
+// scheduler's budget. Returns whether some had to wait for the next tick.
+bool Manager::snapshotCards() {
+  const auto MONITOR = Desktop::focusState()->monitor();
+  if (wanted.empty() || !atlas.configure(MONITOR))
+    return false;
+
+  // Clients only redraw (and damage) when they get frame callbacks. No damage, no snapshot.
+  candidates.clear();
+  for (auto &w : wanted) {
+    w.card->wantedLod = w.lod;
+    w.card->updateMode();
+    w.card->requestFrame(MONITOR);
+    if (w.card->direct) {
+      // nothing to capture, just repaint it where it is
+      if (w.card->takeCommits())
+        damageCard(w.card);
+    } else if (w.card->dirty())
+      candidates.emplace_back(&w);
+  }
+
+  // Only which ones make the cut matters, not their order.
+  const size_t budget = std::min(scheduler.available(), candidates.size());
+  if (budget < candidates.size()) {
+    std::nth_element(candidates.begin(), candidates.begin() + budget, candidates.end(), [](const Wanted *a, const Wanted *b) {
+      return a->priority > b->priority;
+    });
+  }
+
+  const Vector2D mSize = MONITOR->m_size * MONITOR->m_scale;
+  batch.clear();
+  for (size_t i = 0; i < budget; ++i) {
+    if (candidates[i]->card->prepareSnapshot(Monitor::snapshotSize(mSize)))
+      batch.emplace_back(candidates[i]->card);
+  }
+
+  // Cards the worker takes are off the batch. Either way captures only show
+  // up in a later tick, once their fence has signalled (see update()).
+  if (Config::asyncSnapshots && !batch.empty() && worker.start())
+    std::erase_if(batch, [this](WindowCard *card) { return card->queueSnapshot(worker); });
+  if (!batch.empty()) {
+    const auto start = NOW;
+    atlas.snapshot(MONITOR, batch);
+    scheduler.spend(batch.size(), NOW - start);
+  }
+
+  // Whatever didn't fit the budget goes next tick, keep the loop awake for it.
+  return worker.pending() || candidates.size() > budget;
+}
+
+void Manager::damageCard(WindowCard *card) {
+  for (auto &[id, mon] : monitors)
+    mon->damageCard(card);
 }
 
 void Manager::move(Direction dir) {
-  if (!monitors.contains(activeMonitor))
+  if (!initialized || !monitors.contains(activeMonitor))
     return;
 
   auto &mon = monitors[activeMonitor];
   const auto res = layoutStyle->onMove(dir, mon->activeWindow, mon->windows.size());
 
   if (res.index.has_value()) {
+    const int count = mon->windows.size();
+    int step = (int)res.index.value() - (int)mon->activeWindow;
+    if (std::abs(step) > count / 2)
+      step -= (step > 0 ? count : -count);
+    mon->heading = step;
     mon->activeWindow = res.index.value();
     mon->activeChanged();
   } else if (res.changeMonitor) {
@@ -186,16 +570,17 @@ void Manager::move(Direction dir) {
       return;
     activeMonitor = target;
     monitorOffset.set(activeMonitor, false);
+    damageMonitors();
   }
 
-  damageMonitors();
+  wake();
 }
 
 void Manager::draw(MONITORID monid, const CRegion &damage) {
   LOG_SCOPE()
 
   // probably not inited from grace yet.
-  if (monitors.empty())
+  if (!initialized)
     return;
   const auto cur = Desktop::focusState()->monitor();
   auto dmg = damage;
@@ -203,8 +588,12 @@ void Manager::draw(MONITORID monid, const CRegion &damage) {
   if (!monitors.contains(monid))
     return;
 
-  if (!Config::powersave) {
-    g_pHyprOpenGL->renderRect(dmg.getExtents(), CHyprColor(0.0, 0.0, 0.0, (Config::dimEnabled) ? Config::dimAmount : 0), {.blur = sc<bool>(Config::blurBG)});
+  if (cachedBlur()) {
+    monitors[monid]->renderTexture(damage);
+    if (Config::dimEnabled)
+      g_pHyprOpenGL->renderRect(dmg.getExtents(), CHyprColor(0.0, 0.0, 0.0, Config::dimAmount), {.damage = &dmg});
+  } else if (!Config::powersave) {
+    g_pHyprOpenGL->renderRect(dmg.getExtents(), CHyprColor(0.0, 0.0, 0.0, (Config::dimEnabled) ? Config::dimAmount : 0), {.damage = &dmg, .blur = sc<bool>(Config::blurBG)});
   } else {
     if (monitors.contains(monid))
       monitors[monid]->renderTexture(damage);
@@ -212,17 +601,19 @@ void Manager::draw(MONITORID monid, const CRegion &damage) {
 
   if (monid == cur->m_id) {
 #ifndef NDEBUG
-    Overlay->add(std::format("ActiveInternal: {}, ActiveInFocus: {}, monid: {}", activeMonitor, cur->m_name, monid));
+    Overlay->add("ActiveInternal: {}, ActiveInFocus: {}, monid: {}", activeMonitor, cur->m_name, monid);
 #endif
 
     if (!Config::splitMonitor) {
       monitors[monid]->draw(damage, 0, monitorFade.current);
     } else {
       const auto spacing = cur->m_size.y * Config::monitorSpacing;
+      // The active row goes last so it ends up on top.
       int i = 0;
+      int activeMon = 0;
       for (const auto &[id, mon] : monitors) {
         if (id == activeMonitor) {
-          i++;
+          activeMon = i++;
           continue;
         }
 
@@ -230,19 +621,10 @@ void Manager::draw(MONITORID monid, const CRegion &damage) {
         mon->draw(damage, offset, monitorFade.current);
         i++;
       }
-      int activeMon = 0;
-      int counter = 0;
-      for (const auto &[id, mon] : monitors) {
-        if (id == activeMonitor) {
-          activeMon = counter;
-          break;
-        }
-        counter++;
-      }
       float activeOffset = (activeMon - monitorOffset.current) * spacing;
       monitors[activeMonitor]->draw(damage, activeOffset, monitorFade.current);
 #ifndef NDEBUG
-      Overlay->add(std::format("monitor->m_size.x: {}, monitor->m_size.y: {}\nmonitor->m_pixelSize.x: {}, monitor->m_pixelSize.y: {}", monitors[activeMonitor]->monitor->m_size.x, monitors[activeMonitor]->monitor->m_size.y, monitors[activeMonitor]->monitor->m_size.x, monitors[activeMonitor]->monitor->m_size.y));
+      Overlay->add("monitor->m_size.x: {}, monitor->m_size.y: {}\nmonitor->m_pixelSize.x: {}, monitor->m_pixelSize.y: {}", monitors[activeMonitor]->monitor->m_size.x, monitors[activeMonitor]->monitor->m_size.y, monitors[activeMonitor]->monitor->m_size.x, monitors[activeMonitor]->monitor->m_size.y);
 #endif
     }
   }
@@ -260,34 +642,68 @@ void Manager::onConfigReload() {
 
   Config::activeBorderColor = rc<CGradientValueData *>(std::any_cast<void *>(HyprlandAPI::getConfigValue(PHANDLE, "plugin:alttab:border_active")->getValue()));
   Config::inactiveBorderColor = rc<CGradientValueData *>(std::any_cast<void *>(HyprlandAPI::getConfigValue(PHANDLE, "plugin:alttab:border_inactive")->getValue()));
+
+  if (!Config::asyncSnapshots)
+    worker.stop();
+  layoutSerial++;
+  backdrops.invalidateAll();
+  titles.clear();
+  // split_monitor / include_special change which bucket a window belongs to
+  rebuild();
 }
 
 void Manager::onWindowCreated(PHLWINDOW window) {
-  // TODO: add window to specific monitor
-  rebuild();
+  if (!window)
+    return;
+  touch(window);
+  track(window);
+  backdrops.invalidate(window->workspaceID());
+  if (initialized)
+    watchBackdrops();
+  // the loop may be asleep, and the window can be anywhere
+  wake();
 }
 
 void Manager::onWindowDestroyed(PHLWINDOW window) {
   if (!window)
     return;
 
-  auto mon = window->m_monitor.lock();
+  for (auto &[id, pool] : pools)
+    pool.evict(window);
+  mru.erase(window);
+  backdrops.invalidate(window->workspaceID());
 
-  if (mon && monitors.contains(mon->m_id)) {
-    if (monitors[mon->m_id]->removeWindow(window) == 0) {
-      monitors.erase(mon->m_id);
-    }
-  } else {
-    for (auto &[id, mon] : monitors) {
-      if (mon->removeWindow(window) == 0) {
-        monitors.erase(id);
-        break;
-      }
-    }
+  for (auto &[id, mon] : monitors) {
+    if (mon->removeWindow(window) && initialized)
+      mon->activeChanged();
   }
+  wake();
+}
+
+void Manager::onWindowFocused(PHLWINDOW window) {
+  if (!window)
+    return;
+  touch(window);
+  // Don't shuffle the carousel under the user; prepare() sorts on the next open.
+  if (active)
+    return;
+  for (auto &[id, mon] : monitors)
+    mon->promote(window);
+}
+
+void Manager::onWindowMoved(PHLWINDOW window) {
+  if (!window)
+    return;
+  track(window);
+  // don't know where it came from
+  backdrops.invalidateAll();
+  if (initialized)
+    watchBackdrops();
+  wake();
 }
 
 void Manager::onRender(eRenderStage stage) {
+  count(stats.frames);
   if (!active)
     return;
 
@@ -303,21 +719,129 @@ void Manager::onRender(eRenderStage stage) {
   }
 }
 
+void Manager::onPreRender(PHLMONITOR monitor) {
+  if (!initialized || !monitor || monitor != Desktop::focusState()->monitor())
+    return;
+  const auto before = allocationCount();
+  tick();
+  stats.frameAllocations = allocationCount() - before;
+}
+
 void Manager::onFocusChange(PHLMONITOR monitor) {
   if (monitor == nullptr)
     return;
   activeMonitor = monitor->m_id;
   monitorOffset.set(activeMonitor);
+  wake();
 }
 
+void Manager::onMonitorAdded(PHLMONITOR monitor) {
+  if (!monitor || !monitor->m_enabled || monitor->m_isUnsafeFallback || monitors.contains(monitor->m_id))
+    return;
+  monitors[monitor->m_id] = makeUnique<Monitor>(monitor);
+  for (const auto &[w, seq] : mru)
+    track(w);
+  if (initialized)
+    monitors[monitor->m_id]->createTexture();
+}
+
+void Manager::onMonitorRemoved(PHLMONITOR monitor) {
+  if (!monitor)
+    return;
+  monitors.erase(monitor->m_id);
+  pools.erase(monitor->m_id);
+  if (activeMonitor == monitor->m_id && !monitors.empty()) {
+    activeMonitor = monitors.begin()->first;
+    monitorOffset.snap(activeMonitor);
+  }
+}
+
+uint64_t Manager::recency(PHLWINDOW window) const {
+  const auto it = mru.find(window);
+  return it != mru.end() ? it->second : 0;
+}
+
+bool Manager::shouldShow(PHLWINDOW window) const {
+  if (!window || !window->m_isMapped || !mru.contains(window))
+    return false;
+  if (!Config::includeSpecial && window->m_workspace && window->m_workspace->m_isSpecialWorkspace)
+    return false;
+  return true;
+}
+
+static constexpr MONITORID SHARED_POOL = MONITOR_INVALID;
+
+CardPool &Manager::poolFor(MONITORID id) {
+  return pools[Config::splitMonitor ? id : SHARED_POOL];
+}
+
+void Manager::touch(PHLWINDOW window) {
+  mru[window] = ++mruCounter;
+}
+
+// Puts a window in the bucket(s) it belongs to and drops it from the rest.
+// Bookkeeping only, snapshots happen lazily once the carousel is shown.
+void Manager::track(PHLWINDOW window) {
+  const bool show = shouldShow(window);
+  const auto wmon = window->m_monitor.lock();
+
+  for (auto &[id, mon] : monitors) {
+    const bool belongs = show && (!Config::splitMonitor || wmon == mon->monitor);
+    const bool has = mon->contains(window);
+    if (belongs == has)
+      continue;
+
+    if (belongs)
+      mon->insertWindow(poolFor(id).get(window));
+    else
+      mon->removeWindow(window);
+
+    if (initialized)
+      mon->activeChanged();
+  }
+}
+
+// Events can be missed (workspace moved to another monitor, monitor enabled
+// after it was added), so fix up the buckets once per open.
+void Manager::reconcile() {
+  for (const auto &m : g_pCompositor->m_monitors)
+    onMonitorAdded(m);
+
+  std::erase_if(monitors, [this](const auto &it) {
+    const auto &m = it.second->monitor;
+    if (m && m->m_enabled && std::ranges::find(g_pCompositor->m_monitors, m) != g_pCompositor->m_monitors.end())
+      return false;
+    pools.erase(it.first);
+    return true;
+  });
+
+  std::vector<PHLWINDOW> stale;
+  for (const auto &[id, mon] : monitors) {
+    for (const auto &card : mon->windows) {
+      if (!shouldShow(card->window) || (Config::splitMonitor && card->window->m_monitor.lock() != mon->monitor))
+        stale.emplace_back(card->window);
+    }
+  }
+  for (const auto &w : stale)
+    track(w);
+}
+
+// Full resync of every bucket. No GPU work, only used when the config changes
+// what should be shown where.
 void Manager::rebuild() {
+  LOG_SCOPE()
+  for (auto &[id, mon] : monitors)
+    mon->reset(true);
+  // split_monitor may have flipped, drop the pools of the other mode
+  std::erase_if(pools, [](const auto &it) { return (it.first == SHARED_POOL) == Config::splitMonitor; });
+  for (const auto &[w, seq] : mru)
+    track(w);
+}
+
+void Manager::prepare() {
   LOG_SCOPE()
   setLayout();
-  for (const auto &m : g_pCompositor->m_monitors) {
-    if (!m->m_enabled || m->m_isUnsafeFallback)
-      continue;
-    monitors[m->m_id] = makeUnique<Monitor>(m);
-  }
+  reconcile();
 
   // auto activeWindow = Desktop::focusState()->window();
   PHLWINDOWREF activeWindow;
@@ -331,48 +855,26 @@ void Manager::rebuild() {
   activeMonitor = Desktop::focusState()->monitor()->m_id;
   monitorOffset.snap(activeMonitor);
 
-  for (auto &[monID, mon] : monitors) {
-    std::vector<PHLWINDOW> monitorWindows;
-
-    for (auto it = history.rbegin(); it != history.rend(); ++it) {
-      auto w = it->lock();
-      if (!w)
-        continue;
+  // Only resident cards follow resizes, catch up on the rest before laying out.
+  for (auto &[id, pool] : pools)
+    pool.forEach([](WindowCard *card) { card->refreshSize(); });
 
-      if (!Config::includeSpecial && w->m_workspace && w->m_workspace->m_isSpecialWorkspace)
-        continue;
-
-      if (w->m_isMapped && (!Config::splitMonitor || w->m_monitor.lock() == mon->monitor)) {
-        monitorWindows.emplace_back(w);
-      }
-    }
-    /*
-    // TODO: Find a better fallback in-case some window is in the history but not mapped..
-    for (const auto &w : g_pCompositor->m_windows) {
-      if (std::find(monitorWindows.begin(), monitorWindows.end(), w) == monitorWindows.end()) {
-        if (!Config::includeSpecial && w->m_workspace && w->m_workspace->m_isSpecialWorkspace)
-          continue;
-
-        if (w->m_isMapped && (!Config::splitMonitor || w->m_monitor.lock() == mon->monitor)) {
-          monitorWindows.emplace_back(w);
-        }
-      }
-    }
-    */
-
-    for (const auto &w : monitorWindows) {
-      auto card = mon->addWindow(w);
-      if (w == activeWindow) {
-        mon->activeWindow = mon->windows.size() - 1;
-        const int count = monitorWindows.size();
+  for (auto &[monID, mon] : monitors) {
+    mon->sortWindows();
+    mon->activeWindow = 0;
+    mon->rotation.snap(M_PI / 2.0f);
+
+    for (size_t i = 0; i < mon->windows.size(); ++i) {
+      if (mon->windows[i]->window == activeWindow) {
+        mon->activeWindow = i;
+        const int count = mon->windows.size();
         const float angle = (M_PI / 2.0f) + ((2.0f * M_PI * mon->activeWindow) / count);
         mon->rotation.snap(angle);
       }
     }
-    g_pHyprRenderer->damageMonitor(mon->monitor);
-    // damageMonitor should do this??
-    // g_pCompositor->scheduleFrameForMonitor(mon->monitor);
+    // backdrops are captured by warmup(), one monitor per step
   }
+  applyBudget();
 }
 
 bool Manager::isActive() const {
@@ -381,5 +883,7 @@ bool Manager::isActive() const {
 
 void RenderPass::draw(const CRegion &damage) {
   const auto MON = g_pHyprOpenGL->m_renderData.pMonitor;
+  const auto before = allocationCount();
   manager->draw(MON->m_id, damage);
+  manager->stats.frameAllocations += allocationCount() - before;
 }
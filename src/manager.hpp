@@ -1,6 +1,11 @@
 #pragma once
+#include "backdrop.hpp"
 #include "monitor.hpp"
+#include "renderer.hpp"
+#include "scheduler.hpp"
 #include "styles.hpp"
+#include "titles.hpp"
+#include "worker.hpp"
 #include <map>
 #include <src/SharedDefs.hpp>
 #include <src/helpers/time/Timer.hpp>
@@ -13,35 +18,101 @@ public:
   Manager();
   void activate();
   void init();
+  bool warmup(size_t steps);
   void deactivate();
   void toggle();
   void confirm();
   void move(Direction dir);
-  void update(float delta);
+  bool update(float delta);
+  void tick();
+  void wake();
   void rebuild();
+  void prepare();
   void draw(MONITORID monid, const CRegion &damage);
   void damageMonitors();
   bool isActive() const;
 
+  uint64_t recency(PHLWINDOW window) const;
+  std::string statsString() const;
+
+  // Work counters, exposed through `hyprctl alttabstats`.
+  // idle counts anything that ran while the carousel was closed. Commits on
+  // resident cards land there too, one bump each, everything else should not.
+  struct {
+    uint64_t frames = 0;
+    uint64_t ticks = 0;
+    uint64_t snapshots = 0;
+    uint64_t backgrounds = 0;
+    uint64_t idle = 0;
+    // heap allocations of the last tick and draw, see COUNT_ALLOCATIONS
+    uint64_t frameAllocations = 0;
+  } stats;
+  void count(uint64_t &counter);
+  // Releases the snapshot of the least recently shown card that isn't on
+  // screen right now. False if there's nothing left to take.
+  bool evictPreview(const WindowCard *except);
+
+  // Bumped whenever something outside a monitor's own state changes the
+  // layout (style, config, a window resizing). Monitors relayout on change.
+  uint64_t layoutSerial = 0;
+
+  // Declared before the pools so it outlives the cards releasing into it.
+  PreviewAtlas atlas;
+  BackdropCache backdrops;
+  TitleCache titles;
+  CardRenderer renderer;
+
 protected:
   bool active = false;
+  bool initialized = false;
+  bool prepared = false;
+  // no tick scheduled, nothing was moving last time we looked
+  bool sleeping = true;
+  // set for the tick in which finished titles were uploaded
+  bool titlesArrived = false;
+  uint64_t sessionId = 0;
   MONITORID activeMonitor = MONITOR_INVALID;
 
 private:
   void onConfigReload();
   void onWindowCreated(PHLWINDOW window);
   void onWindowDestroyed(PHLWINDOW window);
+  void onWindowFocused(PHLWINDOW window);
+  void onWindowMoved(PHLWINDOW window);
   void onRender(eRenderStage stage);
+  void onPreRender(PHLMONITOR monitor);
   void onFocusChange(PHLMONITOR monitor);
+  void onMonitorAdded(PHLMONITOR monitor);
+  void onMonitorRemoved(PHLMONITOR monitor);
 
+  void hookRender();
+  void unhookRender();
   bool setLayout();
+  bool shouldShow(PHLWINDOW window) const;
+  void touch(PHLWINDOW window);
+  void track(PHLWINDOW window);
+  void reconcile();
+  CardPool &poolFor(MONITORID id);
+  void wantSnapshot(WindowCard *card, float priority, int lod);
+  bool snapshotCards();
+  // Repaints the card wherever a row shows it.
+  void damageCard(WindowCard *card);
+  bool cachedBlur() const;
+  bool blurDue(PHLMONITOR monitor) const;
+  bool refreshBackdrops();
+  void applyBudget();
+  void scheduleWarmup();
+  void watchBackdrops();
 
 #ifdef HYPRLAND_LEGACY
   struct {
     SP<HOOK_CALLBACK_FN> config;
     SP<HOOK_CALLBACK_FN> windowCreated;
     SP<HOOK_CALLBACK_FN> windowDestroyed;
+    SP<HOOK_CALLBACK_FN> windowFocused;
+    SP<HOOK_CALLBACK_FN> windowMoved;
     SP<HOOK_CALLBACK_FN> render;
+    SP<HOOK_CALLBACK_FN> preRender;
     SP<HOOK_CALLBACK_FN> focusChange;
     SP<HOOK_CALLBACK_FN> monitorAdded;
     SP<HOOK_CALLBACK_FN> monitorRemoved;
@@ -51,24 +122,55 @@ private:
     CHyprSignalListener config;
     CHyprSignalListener windowCreated;
     CHyprSignalListener windowDestroyed;
+    CHyprSignalListener windowFocused;
+    CHyprSignalListener windowMoved;
     CHyprSignalListener render;
+    CHyprSignalListener preRender;
     CHyprSignalListener focusChange;
     CHyprSignalListener monitorAdded;
     CHyprSignalListener monitorRemoved;
   } listeners;
 #endif
 
-  SP<CEventLoopTimer> loopTimer;
   SP<CEventLoopTimer> graceTimer;
+  SP<CEventLoopTimer> warmupTimer;
+  // How far warmup() got this activation, past prepare().
+  struct {
+    size_t backdrops = 0;
+    size_t cards = 0;
+    size_t captures = 0;
+  } warmed;
+  // Commits on whatever is behind the carousel while it's open, only with cachedBlur().
+  std::vector<CHyprSignalListener> backdropCommits;
 
   Timestamp lastFrame;
   std::map<MONITORID, UP<Monitor>> monitors;
+  // Keyed by monitor with split_monitor, otherwise a single shared pool.
+  std::map<MONITORID, CardPool> pools;
+  // Cards the rows asked to have captured this tick, one entry per card (see
+  // WindowCard::queued).
+  struct Wanted {
+    WindowCard *card;
+    float priority;
+    int lod;
+  };
+  std::vector<Wanted> wanted;
+  // scratch for snapshotCards(), kept to reuse the storage
+  std::vector<Wanted *> candidates;
+  std::vector<WindowCard *> batch;
+  std::unordered_map<PHLWINDOW, uint64_t> mru;
+  uint64_t mruCounter = 0;
   AnimatedValue<float> monitorOffset;
   AnimatedValue<float> monitorFade;
   Timestamp lastUpdate;
   SP<IStyle> layoutStyle;
+  SnapshotScheduler scheduler;
 
   friend class Monitor;
+
+public:
+  // Last, so it's stopped before anything it captures for goes away.
+  SnapshotWorker worker;
 };
 
 inline UP<Manager> manager;
@@ -12,89 +12,104 @@
 #undef private
 
 #include <src/protocols/PresentationTime.hpp>
+#include <ranges>
 
 Monitor::Monitor(PHLMONITOR monitor) : monitor(monitor) {
-  createTexture();
   activeWindow = 0;
   rotation.snap(M_PI / 2.0f);
   animating = false;
 }
-void Monitor::createTexture() {
-  LOG_SCOPE()
-  g_pHyprRenderer->makeEGLCurrent();
-
-  if (monitor->m_pixelSize.x <= 0 || monitor->m_pixelSize.y <= 0)
-    return;
-
-  if (!bgFb.isAllocated() || bgFb.m_size != monitor->m_pixelSize)
-    bgFb.alloc(monitor->m_pixelSize.x, monitor->m_pixelSize.y, monitor->m_drmFormat);
-  CRegion fullRegion = CBox({0, 0}, monitor->m_pixelSize);
-
-  g_pHyprRenderer->beginRender(monitor, fullRegion, RENDER_MODE_FULL_FAKE, nullptr, &bgFb, false);
-  g_pHyprRenderer->renderWorkspace(monitor, monitor->m_activeWorkspace, NOW, fullRegion.getExtents());
-  g_pHyprRenderer->m_renderPass.render(fullRegion);
-  g_pHyprRenderer->m_renderPass.clear();
-  g_pHyprRenderer->endRender();
-  texture = bgFb.getTexture();
-
-  if (!blurFb.isAllocated() || blurFb.m_size != monitor->m_pixelSize / 2)
-    blurFb.alloc(monitor->m_pixelSize.x / 2, monitor->m_pixelSize.y / 2, monitor->m_drmFormat);
-  CRegion blurRegion = CBox({0, 0}, monitor->m_pixelSize);
-
-  g_pHyprRenderer->beginRender(monitor, blurRegion, RENDER_MODE_FULL_FAKE, nullptr, &blurFb, false);
-
-  CBox destBox = {{0, 0}, monitor->m_pixelSize / 2};
-  CTexPassElement::SRenderData data;
-  data.tex = texture;
-  data.box = destBox;
-  data.blur = true;
-  g_pHyprRenderer->m_renderPass.add(makeUnique<CTexPassElement>(data));
-  CRectPassElement::SRectData blur;
-  blur.box = destBox;
-  blur.color = {0.0, 0.0, 0.0, 0.0};
-  blur.blur = true;
-  g_pHyprRenderer->m_renderPass.add(makeUnique<CRectPassElement>(blur));
-
-#ifndef NDEBUG
-  CRectPassElement::SRectData debug;
-  debug.box = destBox;
-  debug.color = {0.0, 0.0, 1.0, 0.5};
-  g_pHyprRenderer->m_renderPass.add(makeUnique<CRectPassElement>(debug));
-#endif
-  g_pHyprRenderer->m_renderPass.render(blurRegion);
-  g_pHyprRenderer->m_renderPass.clear();
-  g_pHyprRenderer->endRender();
-  blurred = blurFb.getTexture();
+void Monitor::createTexture(bool keepStale) {
+  const auto backdrop = manager->backdrops.get(monitor, keepStale);
+  texture = backdrop.texture;
+  blurred = backdrop.blurred;
 }
 
 void Monitor::renderTexture(const CRegion &damage) {
-  if (!blurred || !texture || !monitor) {
-    LOG(ERR, "FAILED: (!blurred || !texture || !monitor)");
+  if ((Config::blurBG ? !blurred : !texture) || !monitor) {
+    LOG(ERR, "FAILED: no background texture");
     return;
   }
 
-  auto dmg = damage;
   const auto box = CBox{{0, 0}, monitor->m_pixelSize};
   /* Need a better way to do this
     if (DIMENABLED)
     g_pHyprOpenGL->renderRect(dmg.getExtents(), {0, 0, 0, DIMAMOUNT}, {});
   */
   if (Config::blurBG)
-    g_pHyprOpenGL->renderTexture(blurred, box, {});
+    g_pHyprOpenGL->renderTexture(blurred, box, {.damage = &damage});
   else if (Config::powersave)
-    g_pHyprOpenGL->renderTexture(texture, box, {});
+    g_pHyprOpenGL->renderTexture(texture, box, {.damage = &damage});
 }
 
-WP<WindowCard> Monitor::addWindow(PHLWINDOW window) {
-  auto w = makeUnique<WindowCard>(window);
-  windows.emplace_back(std::move(w));
-  return windows.back();
+// windows is kept in MRU order, most recent first.
+void Monitor::insertWindow(SP<WindowCard> card) {
+  const auto seq = manager->recency(card->window);
+  auto it = std::ranges::find_if(windows, [&](const auto &c) {
+    return manager->recency(c->window) < seq;
+  });
+  const size_t idx = std::distance(windows.begin(), it);
+  windows.insert(it, card);
+  version++;
+  if (idx <= activeWindow && windows.size() > 1)
+    activeWindow++;
 }
-size_t Monitor::removeWindow(PHLWINDOW window) {
-  std::erase_if(windows, [&](const auto &card) {
-    return card->window == window;
+
+bool Monitor::removeWindow(PHLWINDOW window) {
+  auto it = std::ranges::find_if(windows, [&](const auto &c) {
+    return c->window == window;
+  });
+  if (it == windows.end())
+    return false;
+
+  const size_t idx = std::distance(windows.begin(), it);
+  if (const auto d = drawn.find(it->get()); d != drawn.end()) {
+    damage.add(d->second.box);
+    drawn.erase(d);
+  }
+  windows.erase(it);
+  version++;
+  std::erase_if(renderTasks, [&](const auto &t) {
+    return t.card->window == window;
+  });
+  if (idx < activeWindow || activeWindow >= windows.size())
+    activeWindow = activeWindow > 0 ? activeWindow - 1 : 0;
+  return true;
+}
+
+bool Monitor::contains(PHLWINDOW window) const {
+  return std::ranges::any_of(windows, [&](const auto &c) {
+    return c->window == window;
   });
-  return windows.size();
+}
+
+void Monitor::promote(PHLWINDOW window) {
+  auto it = std::ranges::find_if(windows, [&](const auto &c) {
+    return c->window == window;
+  });
+  if (it != windows.end()) {
+    std::rotate(windows.begin(), it, it + 1);
+    version++;
+  }
+}
+
+void Monitor::sortWindows() {
+  std::ranges::stable_sort(windows, std::greater{}, [](const auto &c) {
+    return manager->recency(c->window);
+  });
+  version++;
+}
+
+void Monitor::reset(bool clearWindows) {
+  renderTasks.clear();
+  layoutKey.reset();
+  drawn.clear();
+  damage.clear();
+  animating = false;
+  if (clearWindows) {
+    windows.clear();
+    activeWindow = 0;
+  }
 }
 
 bool Monitor::animate(const float delta) {
@@ -107,52 +122,190 @@ bool Monitor::animate(const float delta) {
   return !rotation.done() || !zoom.done() || !alpha.done();
 }
 
+void Monitor::relayout(const Vector2D &mSize) {
+  surfaceSizes.resize(windows.size());
+  for (size_t i = 0; i < windows.size(); ++i)
+    surfaceSizes[i] = windows[i]->surfaceSize;
+
+  const auto ctx = StyleContext{0, windows.size(), activeWindow, rotation.current, zoom.current, alpha.current, mSize, {0, 0}};
+  manager->layoutStyle->calculateBatch(ctx, surfaceSizes, layout);
+
+  // The tasks outlive the tick, only a changed card list rebuilds them.
+  if (tasksVersion != version || renderTasks.size() != windows.size()) {
+    renderTasks.clear();
+    for (size_t i = 0; i < windows.size(); ++i)
+      renderTasks.emplace_back(RenderTask{windows[i].get(), i});
+    tasksVersion = version;
+  }
+
+  const auto maxSize = snapshotSize(mSize);
+  for (auto &task : renderTasks) {
+    const size_t i = task.index;
+    task.data = layout.at(i);
+    const auto preview = WindowCard::boxes(task.data.position, task.data.scale).preview;
+
+    // Each level halves the resolution, pick the smallest still covering the card.
+    const double ratio = std::min(maxSize.x / std::max(1.0, preview.width), maxSize.y / std::max(1.0, preview.height));
+    task.lod = std::clamp((int)std::floor(std::log2(std::max(1.0, ratio))), 0, WindowCard::MAX_LOD);
+    task.active = i == activeWindow;
+    task.resident = Config::residentCards <= 0 || std::abs(offsetOf(i)) <= Config::residentCards / 2;
+  }
+
+  // Painter's order, the front card last. The tasks are still sorted from the
+  // last tick and only a few cards swap places per frame, so an insertion
+  // sort is close to a single pass (and unlike stable_sort needs no buffer).
+  for (auto it = renderTasks.begin(); it != renderTasks.end(); ++it) {
+    const auto to = std::ranges::upper_bound(renderTasks.begin(), it, it->data.z, {}, [](const RenderTask &t) { return t.data.z; });
+    std::rotate(to, it, it + 1);
+  }
+  cull(mSize);
+}
+
+// Front to back, whatever the opaque previews in front already cover can't
+// be seen. visibility is the share of a card's preview left over; snapshots
+// go by it and cards with nothing left aren't drawn at all.
+void Monitor::cull(const Vector2D &mSize) {
+  // below this a card is as good as gone, at or above it nothing shows through
+  static constexpr float MIN_ALPHA = 0.01f;
+  static constexpr float OPAQUE_ALPHA = 0.999f;
+
+  const CBox screen = {{0, 0}, mSize};
+  covered.clear();
+  for (auto &task : renderTasks | std::views::reverse) {
+    const auto &data = task.data;
+    task.visibility = 0.0f;
+    task.hidden = true;
+    task.occluded = false;
+    if (!data.visible || data.alpha < MIN_ALPHA)
+      continue;
+
+    // border and rounding included
+    const CBox card = data.position.copy().expand(2).intersection(screen);
+    if (card.empty())
+      continue;
+    task.hidden = false;
+    task.occluded = left.clear().add(card).subtract(covered).empty();
+
+    const auto preview = WindowCard::boxes(data.position, data.scale).preview;
+    const auto onScreen = preview.intersection(screen);
+    if (preview.width > 0 && preview.height > 0 && !onScreen.empty()) {
+      left.clear().add(onScreen).subtract(covered);
+      int count = 0;
+      double area = 0.0;
+      const auto *rects = pixman_region32_rectangles(left.pixman(), &count);
+      for (int i = 0; i < count; i++)
+        area += (double)(rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+      task.visibility = std::clamp(area / (preview.width * preview.height), 0.0, 1.0);
+    }
+    // a pixel in from the edges, rounding to whole pixels never hides what still shows
+    if (data.alpha >= OPAQUE_ALPHA)
+      covered.add(preview.copy().expand(-1));
+  }
+}
+
 void Monitor::update(const float delta) {
   const auto MONITOR = Desktop::focusState()->monitor();
   const Vector2D mSize = MONITOR->m_size * MONITOR->m_scale;
 
-  bool damage = animate(delta);
+  bool changed = animate(delta);
 
-  renderTasks.clear();
-  for (size_t i = 0; i < windows.size(); ++i) {
-    auto ctx = StyleContext{i, windows.size(), activeWindow, rotation.current, zoom.current, alpha.current, mSize, {0, 0}};
-    auto surfaceSize = windows[i]->window->wlSurface()->getSurfaceBoxGlobal().value_or(CBox{0, 0, 0, 0}).size();
-    auto data = manager->layoutStyle->calculate(ctx, surfaceSize);
-
-    // TODO: get rid of this and do proper depth and clip
-    const auto padding = 4;
-    const auto barHeight = (Config::fontSize + padding) * data.scale;
-    double pX1 = data.position.x, pY1 = data.position.y + barHeight;
-    double pW = data.position.width, pH = data.position.height - barHeight;
-
-    double interW = std::max(0.0, std::min(mSize.x, pX1 + pW) - std::max(0.0, pX1));
-    double interH = std::max(0.0, std::min(mSize.y, pY1 + pH) - std::max(0.0, pY1));
-    float visibility = (pW * pH > 0) ? (float)((interW * interH) / (pW * pH)) : 0.0f;
-
-    renderTasks.emplace_back(RenderTask{windows[i].get(), data, visibility, FloatTime(NOW - windows[i]->lastSnapshot).count()});
+  const LayoutKey key{rotation.current, zoom.current, alpha.current, activeWindow, version, manager->layoutSerial, mSize};
+  if (key != layoutKey) {
+    relayout(mSize);
+    damageCards();
+    layoutKey = key;
+    changed = true;
   }
 
-  std::vector<RenderTask *> snapshotRR;
-  for (auto &t : renderTasks)
-    snapshotRR.emplace_back(&t);
+  if (manager->titlesArrived) {
+    for (const auto &task : renderTasks) {
+      if (const auto d = drawn.find(task.card); task.card->titleOutdated() && d != drawn.end())
+        damage.add(d->second.box);
+    }
+  }
 
-  std::sort(snapshotRR.begin(), snapshotRR.end(), [](const RenderTask *a, const RenderTask *b) {
-    return a->since > b->since;
-  });
+  // Without split_monitor only the focused row is ever drawn, the others
+  // shouldn't hold on to anything.
+  if (!Config::splitMonitor && !isActive()) {
+    animating = changed;
+    return;
+  }
+
+  // Snapshots are taken by the manager once all rows had their say, a card
+  // shared between rows is only captured once.
+  for (auto &task : renderTasks) {
+    if (task.visibility > 0.0f)
+      task.card->markShown();
+    if (!task.resident)
+      continue;
+    task.card->wantResident = true;
+    task.since = FloatTime(NOW - task.card->lastSnapshot).count();
+    task.priority = snapshotPriority(task, mSize);
+    if (task.priority <= 0.0f)
+      continue;
+    // the focused row gets the first pick of the budget
+    manager->wantSnapshot(task.card, task.priority + (isActive() ? 10.0f : 0.0f), task.lod);
+  }
+
+  animating = changed;
+}
 
-  int snapshotsDone = 0;
-  for (auto task : snapshotRR) {
-    if (task->visibility > 0.10f && (!task->card->ready || task->since > 0.5f)) {
-      if (snapshotsDone < 2) {
-        task->card->requestFrame(MONITOR);
-        task->card->snapshot(mSize * Config::windowSize);
-        snapshotsDone++;
-        damage = true;
-      }
+void Monitor::damageCard(WindowCard *card) {
+  if (const auto d = drawn.find(card); d != drawn.end())
+    damage.add(d->second.box);
+}
+
+// Largest a card gets drawn, the focused one in front. Full detail level.
+Vector2D Monitor::snapshotSize(const Vector2D &mSize) {
+  return mSize * Config::windowSize * std::max(1.0f, (float)Config::windowSizeActive);
+}
+
+// Damages the old and new box of every card whose box, alpha or border changed.
+void Monitor::damageCards() {
+  for (const auto &task : renderTasks) {
+    // the border is drawn inside the box, the extra pixels cover rounding
+    auto box = task.data.position.copy().expand(2).round();
+    const Drawn now{box, task.data.alpha, task.active};
+    auto [it, inserted] = drawn.try_emplace(task.card, now);
+    if (inserted) {
+      damage.add(box);
+      continue;
     }
+    auto &prev = it->second;
+    if (prev.box == box && prev.alpha == now.alpha && prev.active == now.active)
+      continue;
+    damage.add(prev.box);
+    damage.add(box);
+    prev = now;
   }
+}
+
+// 0 means don't bother. Closer to the selection, bigger on screen and the
+// next couple of cards in the direction we're tabbing go first.
+float Monitor::snapshotPriority(const RenderTask &task, const Vector2D &mSize) const {
+  const int offset = offsetOf(task.index);
+
+  const bool prefetch = heading != 0 && (offset == heading || offset == heading * 2);
+  if (task.visibility <= 0.0f && !prefetch)
+    return 0.0f;
+
+  const float area = (task.data.position.width * task.data.position.height * task.visibility) / std::max(1.0, mSize.x * mSize.y);
+  const float focus = 1.0f / (1.0f + std::abs(offset));
+  return 4.0f * focus + 2.0f * area + (prefetch ? 2.0f : 0.0f) + std::min(task.since, 1.0f) * 0.1f;
+}
+
+int Monitor::offsetOf(size_t index) const {
+  const int count = windows.size();
+  int offset = (int)index - (int)activeWindow;
+  if (std::abs(offset) > count / 2)
+    offset -= (offset > 0 ? count : -count);
+  return offset;
+}
 
-  animating = damage;
+// Whether box overlaps the region, without building a new region for it.
+static bool touches(const CRegion &region, const CBox &box) {
+  pixman_box32_t rect = {(int32_t)std::floor(box.x), (int32_t)std::floor(box.y), (int32_t)std::ceil(box.x + box.width), (int32_t)std::ceil(box.y + box.height)};
+  return pixman_region32_contains_rectangle(const_cast<CRegion &>(region).pixman(), &rect) != PIXMAN_REGION_OUT;
 }
 
 void Monitor::draw(const CRegion &damage, const float &offset, const float alpha = 1.0f) {
@@ -162,21 +315,26 @@ void Monitor::draw(const CRegion &damage, const float &offset, const float alpha
   if (renderTasks.empty())
     return;
 
-  // Sorting by Z is fine here; it only affects the painter's algorithm order
-  std::sort(renderTasks.begin(), renderTasks.end(), [](const auto &a, const auto &b) {
-    return a.data.z < b.data.z;
-  });
-
-  auto dmg = damage;
+  auto &renderer = manager->renderer;
+  const bool batched = renderer.begin(damage);
   for (const auto &task : renderTasks) {
+    // Occlusion assumes the cards in front are opaque, not so while fading.
+    if (task.hidden || (task.occluded && alpha >= 1.0f))
+      continue;
     auto box = task.data.position;
     box.translate({0.0f, offset});
-    dmg = dmg.intersect(box);
-    task.card->draw(box, task.data.scale, std::min(task.data.alpha, alpha));
+    // everything below is scissored to the damage anyway, skip the calls
+    if (!touches(damage, box.copy().expand(2)))
+      continue;
+    if (batched)
+      task.card->queue(renderer, box, task.data.scale, std::min(task.data.alpha, alpha), task.active);
+    else
+      task.card->draw(box, task.data.scale, std::min(task.data.alpha, alpha), task.active);
   }
+  if (batched)
+    renderer.flush();
 #ifndef NDEBUG
-  if (!dmg.empty())
-    g_pHyprOpenGL->renderRect(dmg.getExtents(), {0.5, 0.5, 0.0, 0.5}, {});
+  g_pHyprOpenGL->renderRect(damage.getExtents(), {0.5, 0.5, 0.0, 0.2}, {});
 #endif
 }
 
@@ -185,10 +343,6 @@ void Monitor::activeChanged() {
   if (count <= 0)
     return;
 
-  for (auto i = 0; i < windows.size(); ++i) {
-    windows[i]->isActive = (i == activeWindow);
-  }
-
   // Why am i doing this backwards??
   const auto target = (M_PI / 2) + (M_PI * 2.0f * activeWindow) / count;
   auto diff = target - rotation.target;
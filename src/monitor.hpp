@@ -7,23 +7,73 @@ class Monitor {
 private:
   struct RenderTask {
     WindowCard *card;
+    size_t index;
     RenderData data;
+    int lod = 0;
     float visibility = 0.0f;
     float since = 0.0f;
+    float priority = 0.0f;
+    bool active = false;
+    bool resident = false;
+    // Off screen or see-through, and fully behind opaque cards. See cull().
+    bool hidden = false;
+    bool occluded = false;
   };
+  // Everything the layout depends on. When it matches the last tick the
+  // cached renderTasks are reused as-is.
+  struct LayoutKey {
+    float rotation, zoom, alpha;
+    size_t activeWindow;
+    uint64_t version, serial;
+    Vector2D mSize;
+    bool operator==(const LayoutKey &) const = default;
+  };
+
+  float snapshotPriority(const RenderTask &task, const Vector2D &mSize) const;
+  // Signed steps from the selection, the short way around.
+  int offsetOf(size_t index) const;
+  void relayout(const Vector2D &mSize);
+  void cull(const Vector2D &mSize);
   std::vector<RenderTask> renderTasks;
+  // version the tasks were built for
+  uint64_t tasksVersion = 0;
+  // opaque previews seen so far while culling, front to back, and what's
+  // left of the current card
+  CRegion covered, left;
+  std::vector<Vector2D> surfaceSizes;
+  RenderBatch layout;
+  std::optional<LayoutKey> layoutKey;
+  // bumped whenever the card list changes
+  uint64_t version = 0;
+  // What each card looked like the last time it was damaged, so only cards
+  // that actually changed get repainted.
+  struct Drawn {
+    CBox box;
+    float alpha;
+    bool active;
+  };
+  std::unordered_map<WindowCard *, Drawn> drawn;
+  void damageCards();
 
 public:
   Monitor(PHLMONITOR monitor);
-  void createTexture();
+  // keepStale takes a backdrop that's out of date over rendering it now.
+  void createTexture(bool keepStale = false);
   void renderTexture(const CRegion &damage);
-  WP<WindowCard> addWindow(PHLWINDOW window);
-  size_t removeWindow(PHLWINDOW window);
+  void insertWindow(SP<WindowCard> card);
+  bool removeWindow(PHLWINDOW window);
+  bool contains(PHLWINDOW window) const;
+  void promote(PHLWINDOW window);
+  void sortWindows();
+  void reset(bool clearWindows = false);
   bool animate(const float delta);
   void update(const float delta);
   void draw(const CRegion &damage, const float &offset, const float alpha);
   void activeChanged();
   bool isActive() const;
+  // Repaints wherever this row last drew the card.
+  void damageCard(WindowCard *card);
+  static Vector2D snapshotSize(const Vector2D &mSize);
 
   bool animating = false;
   AnimatedValue<float> rotation;
@@ -33,7 +83,10 @@ public:
   PHLMONITOR monitor;
   SP<CTexture> texture;
   SP<CTexture> blurred;
-  CFramebuffer bgFb, blurFb;
   size_t activeWindow = 0;
-  std::vector<UP<WindowCard>> windows;
+  // Signed step of the last move, used to prefetch in the direction of travel.
+  int heading = 0;
+  std::vector<SP<WindowCard>> windows;
+  // Monitor-local pixel region that changed since the last frame, taken by Manager::tick().
+  CRegion damage;
 };
@@ -0,0 +1,317 @@
+#include "renderer.hpp"
+#include "manager.hpp"
+#include <cstddef>
+#include <numeric>
+#define private public
+#include <src/render/OpenGL.hpp>
+#include <src/render/Renderer.hpp>
+#undef private
+
+static const std::string VERTEX = R"#(#version 300 es
+precision highp float;
+uniform mat3 proj;
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 box;
+layout(location = 2) in vec4 content;
+layout(location = 3) in vec4 titleBox;
+layout(location = 4) in vec4 titleUV;
+layout(location = 5) in vec4 previewUV;
+layout(location = 6) in vec4 from;
+layout(location = 7) in vec4 to;
+layout(location = 8) in vec4 params;
+layout(location = 9) in float title;
+out vec2 pos;
+flat out vec4 vBox, vContent, vTitleBox, vTitleUV, vPreviewUV, vFrom, vTo, vParams;
+flat out float vTitle;
+
+void main() {
+  pos = box.xy + corner * box.zw;
+  gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);
+  vBox = box;
+  vContent = content;
+  vTitleBox = titleBox;
+  vTitleUV = titleUV;
+  vPreviewUV = previewUV;
+  vFrom = from;
+  vTo = to;
+  vParams = params;
+  vTitle = title;
+}
+)#";
+
+static const std::string FRAGMENT = R"#(#version 300 es
+precision highp float;
+uniform sampler2D titles;
+uniform sampler2D pages[8];
+uniform float rounding;
+uniform float power;
+in vec2 pos;
+flat in vec4 vBox, vContent, vTitleBox, vTitleUV, vPreviewUV, vFrom, vTo, vParams;
+flat in float vTitle;
+out vec4 fragColor;
+
+bool inside(vec2 p, vec4 b) {
+  return all(greaterThanEqual(p, b.xy)) && all(lessThan(p, b.xy + b.zw));
+}
+
+// GLSL ES only takes constant sampler indices
+vec4 preview(int page, vec2 uv) {
+  if (page == 0) return textureLod(pages[0], uv, 0.0);
+  if (page == 1) return textureLod(pages[1], uv, 0.0);
+  if (page == 2) return textureLod(pages[2], uv, 0.0);
+  if (page == 3) return textureLod(pages[3], uv, 0.0);
+  if (page == 4) return textureLod(pages[4], uv, 0.0);
+  if (page == 5) return textureLod(pages[5], uv, 0.0);
+  if (page == 6) return textureLod(pages[6], uv, 0.0);
+  if (page == 7) return textureLod(pages[7], uv, 0.0);
+  return vec4(0.0);
+}
+
+// to the edge of a box with superellipse corners, negative inside
+float edgeDistance(vec2 p, vec4 b, float radius) {
+  vec2 halfSize = b.zw * 0.5;
+  vec2 q = abs(p - b.xy - halfSize) - halfSize + radius;
+  vec2 c = max(q, 0.0);
+  return pow(pow(c.x, power) + pow(c.y, power), 1.0 / power) + min(max(q.x, q.y), 0.0) - radius;
+}
+
+void main() {
+  // client buffer, content is the preview it's clipped to
+  if (vTitle > 2.5) {
+    if (!inside(pos, vContent))
+      discard;
+    vec4 color = preview(int(vParams.z), (pos - vBox.xy) / vBox.zw);
+    if (vParams.w > 0.5)
+      color.a = 1.0;
+    fragColor = color * vParams.x;
+    return;
+  }
+
+  vec4 color;
+  if (inside(pos, vContent)) {
+    float bar = vParams.y;
+    if (pos.y < vContent.y + bar) {
+      color = vec4(0.0, 0.0, 0.0, 0.8);
+      vec4 placeholder = vec4(vContent.x + vContent.z * 0.3, vContent.y + bar * 0.35, vContent.z * 0.4, bar * 0.3);
+      if (vTitle > 1.5 && inside(pos, vTitleBox)) {
+        vec4 text = textureLod(titles, mix(vTitleUV.xy, vTitleUV.zw, (pos - vTitleBox.xy) / vTitleBox.zw), 0.0);
+        color = text + color * (1.0 - text.a);
+      } else if (vTitle > 0.5 && vTitle < 1.5 && inside(pos, placeholder)) {
+        color = vec4(0.15) + color * 0.85;
+      }
+    } else {
+      color = vec4(0.0, 0.0, 0.0, 1.0);
+      int page = int(vParams.z);
+      if (page >= 0) {
+        vec2 t = (pos - vec2(vContent.x, vContent.y + bar)) / vec2(vContent.z, vContent.w - bar);
+        color = vec4(preview(page, mix(vPreviewUV.xy, vPreviewUV.zw, t)).rgb, 1.0);
+      }
+    }
+  } else {
+    float coverage = clamp(0.5 - edgeDistance(pos, vBox, rounding), 0.0, 1.0);
+    vec2 dir = vec2(cos(vParams.w), sin(vParams.w));
+    float t = clamp(dot((pos - vBox.xy) / vBox.zw - 0.5, dir) + 0.5, 0.0, 1.0);
+    color = mix(vFrom, vTo, t) * coverage;
+  }
+  fragColor = color * vParams.x;
+}
+)#";
+
+static std::array<float, 4> toArray(const CBox &box) {
+  return {(float)box.x, (float)box.y, (float)box.width, (float)box.height};
+}
+
+static std::array<float, 4> toArray(const std::pair<Vector2D, Vector2D> &uv) {
+  return {(float)uv.first.x, (float)uv.first.y, (float)uv.second.x, (float)uv.second.y};
+}
+
+static std::array<float, 4> premultiplied(const CHyprColor &color) {
+  return {(float)(color.r * color.a), (float)(color.g * color.a), (float)(color.b * color.a), (float)color.a};
+}
+
+CardRenderer::~CardRenderer() {
+  if (!program)
+    return;
+  g_pHyprRenderer->makeEGLCurrent();
+  glDeleteBuffers(1, &buffer);
+  glDeleteBuffers(1, &quad);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteProgram(program);
+}
+
+bool CardRenderer::setup() {
+  if (program || failed)
+    return program;
+
+  program = g_pHyprOpenGL->createProgram(VERTEX, FRAGMENT, true, true);
+  if (!program) {
+    LOG(ERR, "card shader didn't build, drawing cards one by one");
+    failed = true;
+    return false;
+  }
+  uniforms = {
+      .proj = glGetUniformLocation(program, "proj"),
+      .titles = glGetUniformLocation(program, "titles"),
+      .pages = glGetUniformLocation(program, "pages"),
+      .rounding = glGetUniformLocation(program, "rounding"),
+      .power = glGetUniformLocation(program, "power"),
+  };
+
+  static constexpr float CORNERS[] = {0, 0, 1, 0, 0, 1, 1, 1};
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  glGenBuffers(1, &quad);
+  glBindBuffer(GL_ARRAY_BUFFER, quad);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(CORNERS), CORNERS, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  const auto attribute = [](GLuint index, GLint size, size_t offset) {
+    glEnableVertexAttribArray(index);
+    glVertexAttribPointer(index, size, GL_FLOAT, GL_FALSE, sizeof(Instance), (void *)offset);
+    glVertexAttribDivisor(index, 1);
+  };
+  attribute(1, 4, offsetof(Instance, box));
+  attribute(2, 4, offsetof(Instance, content));
+  attribute(3, 4, offsetof(Instance, titleBox));
+  attribute(4, 4, offsetof(Instance, titleUV));
+  attribute(5, 4, offsetof(Instance, previewUV));
+  attribute(6, 4, offsetof(Instance, from));
+  attribute(7, 4, offsetof(Instance, to));
+  attribute(8, 4, offsetof(Instance, params));
+  attribute(9, 1, offsetof(Instance, title));
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return true;
+}
+
+bool CardRenderer::begin(const CRegion &region) {
+  if (!setup())
+    return false;
+  damage = &region;
+  instances.clear();
+  pages.clear();
+  return true;
+}
+
+// Sampler slot for a preview page, -1 if they're all taken.
+int CardRenderer::bind(const SP<CTexture> &texture) {
+  const auto it = std::ranges::find(pages, texture);
+  if (it != pages.end())
+    return std::distance(pages.begin(), it);
+  if (pages.size() >= MAX_PAGES)
+    return -1;
+  pages.emplace_back(texture);
+  return pages.size() - 1;
+}
+
+void CardRenderer::add(const Card &card) {
+  int page = -1;
+  if (card.preview) {
+    page = bind(card.preview);
+    if (page < 0) {
+      flush();
+      page = bind(card.preview);
+    }
+  }
+
+  // Cards are drawn with the pass' render modifications, like everything else.
+  const auto &modif = g_pHyprOpenGL->m_renderData.renderModif;
+  CBox content = card.box, outer = card.box.copy().expand(Config::borderSize), text = card.titleBox;
+  modif.applyToBox(content);
+  modif.applyToBox(outer);
+  modif.applyToBox(text);
+
+  // Gradients are approximated by their first and last stop.
+  const auto *gradient = card.active ? Config::activeBorderColor : Config::inactiveBorderColor;
+  const bool hasColors = gradient && !gradient->m_colors.empty();
+  const auto from = hasColors ? premultiplied(gradient->m_colors.front()) : std::array<float, 4>{};
+  const auto to = hasColors ? premultiplied(gradient->m_colors.back()) : std::array<float, 4>{};
+
+  instances.emplace_back(Instance{
+      .box = toArray(outer),
+      .content = toArray(content),
+      .titleBox = toArray(text),
+      .titleUV = toArray(card.titleUV),
+      .previewUV = toArray(card.previewUV),
+      .from = from,
+      .to = to,
+      .params = {card.alpha, (float)(card.barHeight * content.height / std::max(1.0, card.box.height)), (float)page, gradient ? gradient->m_angle : 0.0f},
+      .title = (float)card.title,
+  });
+}
+
+void CardRenderer::add(const Surface &surface) {
+  int page = bind(surface.texture);
+  if (page < 0) {
+    flush();
+    page = bind(surface.texture);
+  }
+
+  const auto &modif = g_pHyprOpenGL->m_renderData.renderModif;
+  CBox box = surface.box, clip = surface.clip;
+  modif.applyToBox(box);
+  modif.applyToBox(clip);
+  instances.emplace_back(Instance{
+      .box = toArray(box),
+      .content = toArray(clip),
+      .params = {surface.alpha, 0.0f, (float)page, surface.opaque ? 1.0f : 0.0f},
+      .title = (float)SURFACE,
+  });
+}
+
+void CardRenderer::flush() {
+  if (instances.empty() || !damage)
+    return;
+
+  const auto &data = g_pHyprOpenGL->m_renderData;
+  g_pHyprOpenGL->useProgram(program);
+  const auto proj = data.projection.copy().multiply(data.monitorProjection);
+  glUniformMatrix3fv(uniforms.proj, 1, GL_TRUE, proj.getMatrix().data());
+  // like renderBorder(), the outer radius grows with the border unless it's square
+  glUniform1f(uniforms.rounding, Config::borderRounding > 0 ? Config::borderRounding + Config::borderSize : 0.0f);
+  glUniform1f(uniforms.power, std::max(1.0f, (float)Config::borderRoundingPower));
+
+  // Unit 0 is the title page, the previews follow.
+  const auto bindUnit = [](GLuint unit, const SP<CTexture> &texture) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(texture->m_target, texture->m_texID);
+    glTexParameteri(texture->m_target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(texture->m_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  };
+  if (const auto titles = manager->titles.texture())
+    bindUnit(0, titles);
+  for (size_t i = 0; i < pages.size(); ++i)
+    bindUnit(i + 1, pages[i]);
+  std::array<GLint, MAX_PAGES> units;
+  std::iota(units.begin(), units.end(), 1);
+  glUniform1i(uniforms.titles, 0);
+  glUniform1iv(uniforms.pages, MAX_PAGES, units.data());
+
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(), GL_STREAM_DRAW);
+  g_pHyprOpenGL->blend(true);
+  // straight from pixman, getRects() would build a vector every flush
+  int count = 0;
+  const auto *rects = pixman_region32_rectangles(const_cast<CRegion *>(damage)->pixman(), &count);
+  for (int i = 0; i < count; ++i) {
+    g_pHyprOpenGL->scissor(&rects[i]);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances.size());
+  }
+  g_pHyprOpenGL->scissor(nullptr);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  for (size_t i = 0; i <= pages.size(); ++i) {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+
+  instances.clear();
+  pages.clear();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "defines.hpp"
+#include <array>
+#include <hyprutils/math/Box.hpp>
+#include <hyprutils/math/Region.hpp>
+#include <src/render/Texture.hpp>
+#include <vector>
+
+// Draws whole cards (border, title bar, title, preview) as instances of one
+// quad with a dedicated shader, so a row costs a draw call per damage rect
+// instead of half a dozen per card. Instances are drawn in order, which keeps
+// the painter's order of overlapping cards intact.
+// Direct previews go in the batch too, each client buffer as a quad clipped
+// to its card, sampled like a page.
+// A batch is flushed early when a card needs a texture that doesn't fit in
+// the bound samplers, or something has to be drawn between two cards.
+class CardRenderer {
+public:
+  enum TitleMode : uint8_t {
+    TITLE_NONE,
+    TITLE_PLACEHOLDER,
+    TITLE_TEXT,
+    // not a card, a client buffer of a direct preview
+    SURFACE,
+  };
+
+  struct Card {
+    // content box, the border goes around it
+    CBox box;
+    float barHeight = 0.0f;
+    CBox titleBox;
+    std::pair<Vector2D, Vector2D> titleUV;
+    TitleMode title = TITLE_NONE;
+    SP<CTexture> preview;
+    std::pair<Vector2D, Vector2D> previewUV;
+    bool active = false;
+    float alpha = 1.0f;
+  };
+
+  // A client buffer drawn into box, clipped to the card's preview.
+  struct Surface {
+    SP<CTexture> texture;
+    CBox box;
+    CBox clip;
+    bool opaque = false;
+    float alpha = 1.0f;
+  };
+
+  ~CardRenderer();
+  // False if the shader isn't usable, cards are then drawn one by one.
+  bool begin(const CRegion &damage);
+  void add(const Card &card);
+  void add(const Surface &surface);
+  void flush();
+
+private:
+  // Matches the attribute layout in the vertex shader.
+  struct Instance {
+    std::array<float, 4> box, content, titleBox, titleUV, previewUV, from, to;
+    // alpha, bar height, preview sampler (-1 for none), gradient angle
+    // (for surfaces: alpha, unused, sampler, opaque)
+    std::array<float, 4> params;
+    float title;
+  };
+
+  static constexpr int MAX_PAGES = 8;
+
+  bool setup();
+  int bind(const SP<CTexture> &texture);
+
+  bool failed = false;
+  uint32_t program = 0;
+  uint32_t vao = 0;
+  uint32_t quad = 0;
+  uint32_t buffer = 0;
+  struct {
+    int proj, titles, pages, rounding, power;
+  } uniforms;
+
+  const CRegion *damage = nullptr;
+  std::vector<Instance> instances;
+  std::vector<SP<CTexture>> pages;
+};
@@ -0,0 +1,27 @@
+#include "scheduler.hpp"
+#include <algorithm>
+#include <cmath>
+
+void SnapshotScheduler::beginFrame() {
+  remaining = std::max(0.0f, (float)Config::snapshotBudget);
+  spent = false;
+}
+
+size_t SnapshotScheduler::available() const {
+  // Always let one through per frame, otherwise a tiny budget starves everything.
+  const auto n = (size_t)std::floor(remaining / std::max(costMs, 0.01f));
+  return spent ? n : std::max<size_t>(n, 1);
+}
+
+void SnapshotScheduler::spend(size_t cards, FloatTime took) {
+  if (cards == 0)
+    return;
+  const float ms = took.count() * 1000.0f;
+  costMs = std::lerp(costMs, ms / cards, 0.2f);
+  remaining -= ms;
+  spent = true;
+}
+
+float SnapshotScheduler::cost() const {
+  return costMs;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "defines.hpp"
+
+// Spreads preview captures over frames. The per-frame budget is shared by all
+// monitors and converted to a card count from the measured cost per capture,
+// so fast GPUs fill the carousel quickly and slow ones don't drop frames.
+class SnapshotScheduler {
+public:
+  void beginFrame();
+  size_t available() const;
+  void spend(size_t cards, FloatTime took);
+  float cost() const;
+
+private:
+  float remaining = 0.0f;
+  bool spent = false;
+  // ms per card, exponential moving average
+  float costMs = 1.0f;
+};
@@ -4,6 +4,47 @@
 #include <src/desktop/state/FocusState.hpp>
 #include <src/helpers/Monitor.hpp>
 
+void RenderBatch::resize(size_t count) {
+  for (auto v : {&x, &y, &width, &height, &z, &rotation, &scale, &alpha})
+    v->resize(count);
+  visible.resize(count);
+}
+
+size_t RenderBatch::size() const {
+  return visible.size();
+}
+
+RenderData RenderBatch::at(size_t i) const {
+  return {
+      .visible = visible[i] != 0,
+      .z = z[i],
+      .rotation = rotation[i],
+      .scale = scale[i],
+      .alpha = alpha[i],
+      .position = {x[i], y[i], width[i], height[i]}};
+}
+
+void RenderBatch::set(size_t i, const RenderData &data) {
+  visible[i] = data.visible;
+  z[i] = data.z;
+  rotation[i] = data.rotation;
+  scale[i] = data.scale;
+  alpha[i] = data.alpha;
+  x[i] = data.position.x;
+  y[i] = data.position.y;
+  width[i] = data.position.width;
+  height[i] = data.position.height;
+}
+
+void IStyle::calculateBatch(const StyleContext &ctx, const std::vector<Vector2D> &surfaceSizes, RenderBatch &out) const {
+  out.resize(surfaceSizes.size());
+  auto c = ctx;
+  for (size_t i = 0; i < surfaceSizes.size(); ++i) {
+    c.index = i;
+    out.set(i, calculate(c, surfaceSizes[i]));
+  }
+}
+
 RenderData Carousel::calculate(const StyleContext &ctx, const Vector2D &surfaceSize) const {
   const Vector2D center = {ctx.mSize.x / 2.0f, (ctx.mSize.y / 2.0f) + ctx.offset.y};
 
@@ -50,6 +91,129 @@ RenderData Carousel::calculate(const StyleContext &ctx, const Vector2D &surfaceS
       .position = box};
 }
 
+// Batch version of Carousel::calculate(), which stays the reference. Written
+// branch-free over plain arrays with polynomial sin/cos so the compiler can
+// vectorize it: NEON on aarch64, SSE2 and an AVX2 clone picked at load time on x86-64.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+namespace {
+constexpr float PI_F = M_PI;
+constexpr float TWO_PI_F = 2.0 * M_PI;
+constexpr float HALF_PI_F = M_PI / 2.0;
+
+// Round half to even like std::remainder, without needing SSE4.1 for floor.
+// Only valid for |x| < 2^22, which angles in turns always are.
+inline float roundEven(float x) {
+  constexpr float MAGIC = 12582912.0f; // 1.5 * 2^23
+  return (x + MAGIC) - MAGIC;
+}
+
+// ~4e-6 max error, plenty for pixel positions.
+inline float fastSin(float x) {
+  x = x - TWO_PI_F * roundEven(x * (1.0f / TWO_PI_F));
+  // fold into [-pi/2, pi/2], sin(x) == sin(pi - x)
+  x = std::min(x, PI_F - x);
+  x = std::max(x, -PI_F - x);
+  const float x2 = x * x;
+  return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f)))));
+}
+
+inline float fastCos(float x) {
+  return fastSin(x + HALF_PI_F);
+}
+
+struct CarouselParams {
+  float rotation, count, zoom, ctxAlpha;
+  float mW, mH, centerX, centerY;
+  float warpScale, sizeInactive, sizeActive, windowSize, unfocusedAlpha;
+  float radius, tiltOffset;
+};
+
+SIMD_CLONES void carouselKernel(const CarouselParams p, size_t n, const float *aspect, float *__restrict outX, float *__restrict outY, float *__restrict outW, float *__restrict outH,
+                                float *__restrict outZ, float *__restrict outRot, float *__restrict outScale, float *__restrict outAlpha, uint8_t *__restrict outVisible) {
+  const float maxW = p.mW * p.windowSize * 1.5f;
+  const float baseline = p.unfocusedAlpha * p.ctxAlpha;
+  const float alphaMul = 0.5f + 0.5f * p.ctxAlpha;
+
+  for (size_t i = 0; i < n; ++i) {
+    const float baseAngle = p.rotation - (TWO_PI_F * (float)(int)i) / p.count;
+    const float angle = baseAngle - p.warpScale * fastSin(2.0f * baseAngle);
+
+    const float rel = angle - HALF_PI_F;
+    const float dist = std::abs(rel - TWO_PI_F * roundEven(rel * (1.0f / TWO_PI_F)));
+    const float z = fastSin(angle);
+    const float depth = (z + 1.0f) * 0.5f;
+
+    const float f = std::max(0.0f, 1.0f - dist / HALF_PI_F);
+    const float focusWeight = f * f * std::sqrt(f);
+    const float depthScale = p.sizeInactive + (1.0f - p.sizeInactive) * depth;
+    const float scale = depthScale * (1.0f + (p.sizeActive - 1.0f) * focusWeight * p.zoom);
+
+    float w = p.mH * p.windowSize * aspect[i] * scale;
+    float h = p.mH * p.windowSize * scale;
+    const float clampedH = maxW / aspect[i];
+    h = w > maxW ? clampedH : h;
+    w = std::min(w, maxW);
+
+    const float radiusScale = p.radius * (0.85f + 0.15f * depth);
+    const float x = p.centerX + (radiusScale * 1.4f) * fastCos(angle) - w * 0.5f;
+    const float y = (p.centerY - p.tiltOffset) + z * p.tiltOffset - h * 0.5f;
+
+    const float a = std::max(0.0f, 1.0f - dist / (PI_F / 1.25f));
+    const float alphaWeight = a * a;
+    const float from = baseline + (z + 1.0f) * 0.2f;
+    const float alpha = (from + (1.0f - from) * alphaWeight) * alphaMul;
+
+    outX[i] = x;
+    outY[i] = y;
+    outW[i] = w;
+    outH[i] = h;
+    outZ[i] = z + alphaWeight * 0.1f;
+    outRot[i] = angle;
+    outScale[i] = scale;
+    outAlpha[i] = std::min(std::max(alpha, 0.0f), 1.0f);
+    outVisible[i] = (alpha > 0.01f) & (x < p.mW) & (x + w > 0.0f) & (y < p.mH) & (y + h > 0.0f);
+  }
+}
+} // namespace
+
+void Carousel::calculateBatch(const StyleContext &ctx, const std::vector<Vector2D> &surfaceSizes, RenderBatch &out) const {
+  const size_t n = surfaceSizes.size();
+  out.resize(n);
+  if (n == 0)
+    return;
+
+  auto &aspect = out.aspect;
+  aspect.resize(n);
+  for (size_t i = 0; i < n; ++i)
+    aspect[i] = (surfaceSizes[i].y > 0) ? surfaceSizes[i].x / surfaceSizes[i].y : 1.77f;
+
+  const float radius = (ctx.mSize.x * 0.5f) * Config::carouselSize;
+  const CarouselParams params{
+      .rotation = ctx.rotation,
+      .count = (float)ctx.count,
+      .zoom = ctx.scale,
+      .ctxAlpha = ctx.alpha,
+      .mW = (float)ctx.mSize.x,
+      .mH = (float)ctx.mSize.y,
+      .centerX = (float)(ctx.mSize.x / 2.0f),
+      .centerY = (float)((ctx.mSize.y / 2.0f) + ctx.offset.y),
+      .warpScale = Config::warp + (1.0f - Config::windowSizeInactive) * 0.2f,
+      .sizeInactive = Config::windowSizeInactive,
+      .sizeActive = Config::windowSizeActive,
+      .windowSize = Config::windowSize,
+      .unfocusedAlpha = Config::unfocusedAlpha,
+      .radius = radius,
+      .tiltOffset = radius * std::sin(Config::tilt * (PI_F / 180.0f)),
+  };
+
+  carouselKernel(params, n, aspect.data(), out.x.data(), out.y.data(), out.width.data(), out.height.data(), out.z.data(), out.rotation.data(), out.scale.data(), out.alpha.data(), out.visible.data());
+}
+
 MoveResult Carousel::onMove(Direction dir, const size_t index, const size_t count) {
   if (dir == Direction::UP || dir == Direction::DOWN)
     return {.changeMonitor = true};
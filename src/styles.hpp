@@ -23,6 +23,19 @@ struct RenderData {
   CBox position;
 };
 
+// Structure-of-arrays layout for every card of a row, see IStyle::calculateBatch().
+struct RenderBatch {
+  std::vector<float> x, y, width, height, z, rotation, scale, alpha;
+  std::vector<uint8_t> visible;
+  // input scratch for styles that work on aspect ratios
+  std::vector<float> aspect;
+
+  void resize(size_t count);
+  size_t size() const;
+  RenderData at(size_t i) const;
+  void set(size_t i, const RenderData &data);
+};
+
 struct MoveResult {
   bool changeMonitor = false;
   std::optional<size_t> index = std::nullopt;
@@ -32,12 +45,16 @@ class IStyle {
 public:
   virtual ~IStyle() = default;
   virtual RenderData calculate(const StyleContext &ctx, const Vector2D &surfaceSize) const = 0;
+  // Lays out all cards in one go, ctx.index is ignored. The default just calls
+  // calculate() per card; styles with heavy math override it.
+  virtual void calculateBatch(const StyleContext &ctx, const std::vector<Vector2D> &surfaceSizes, RenderBatch &out) const;
   virtual MoveResult onMove(Direction dir, const size_t index, const size_t count) = 0;
 };
 
 class Carousel : public IStyle {
 public:
   RenderData calculate(const StyleContext &ctx, const Vector2D &surfaceSize) const override;
+  void calculateBatch(const StyleContext &ctx, const std::vector<Vector2D> &surfaceSizes, RenderBatch &out) const override;
   MoveResult onMove(Direction dir, const size_t index, const size_t count) override;
 };
 
@@ -0,0 +1,390 @@
+#include "titles.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <drm_fourcc.h>
+#include <pango/pangocairo.h>
+#include <src/config/ConfigValue.hpp>
+#define private public
+#include <src/render/OpenGL.hpp>
+#undef private
+
+static constexpr size_t MAX_TITLES = 256;
+// Keeps linear filtering from bleeding neighbours into a title.
+static constexpr int PADDING = 2;
+
+TitleRasterizer::TitleRasterizer() : atlas(ATLAS_SIZE * ATLAS_SIZE, 0) {
+  auto *context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+  layout = pango_layout_new(context);
+  g_object_unref(context);
+  pango_layout_set_single_paragraph_mode(layout, true);
+}
+
+TitleRasterizer::~TitleRasterizer() {
+  reset();
+  for (const auto &p : ellipsis)
+    g_object_unref(p.font);
+  g_object_unref(layout);
+}
+
+void TitleRasterizer::setFont(int size, const std::string &font) {
+  if (size == pixelSize && font == family)
+    return;
+  pixelSize = size;
+  family = font;
+  reset();
+
+  auto *desc = pango_font_description_from_string(family.empty() ? "Sans" : family.c_str());
+  pango_font_description_set_absolute_size(desc, size * PANGO_SCALE);
+  pango_layout_set_font_description(layout, desc);
+  pango_font_description_free(desc);
+
+  // The layout only keeps its fonts alive for the current text.
+  for (const auto &p : ellipsis)
+    g_object_unref(p.font);
+  ellipsis = shape("…", ellipsisWidth);
+  for (const auto &p : ellipsis)
+    g_object_ref(p.font);
+}
+
+std::vector<TitleRasterizer::Placed> TitleRasterizer::shape(const std::string &text, float &width) {
+  pango_layout_set_text(layout, text.c_str(), -1);
+  PangoRectangle logical;
+  pango_layout_get_pixel_extents(layout, nullptr, &logical);
+  lineHeight = logical.height;
+  baseline = pango_layout_get_baseline(layout) / PANGO_SCALE;
+
+  std::vector<Placed> out;
+  float pen = 0.0f;
+  const auto *line = pango_layout_get_line_readonly(layout, 0);
+  for (auto *run = line ? line->runs : nullptr; run; run = run->next) {
+    const auto *item = (PangoGlyphItem *)run->data;
+    for (int i = 0; i < item->glyphs->num_glyphs; ++i) {
+      const auto &info = item->glyphs->glyphs[i];
+      const float advance = (float)info.geometry.width / PANGO_SCALE;
+      out.push_back({item->item->analysis.font, info.glyph, pen, (float)info.geometry.x_offset / PANGO_SCALE, (float)info.geometry.y_offset / PANGO_SCALE, advance});
+      pen += advance;
+    }
+  }
+  width = pen;
+  return out;
+}
+
+const TitleRasterizer::Glyph *TitleRasterizer::glyph(PangoFont *font, uint32_t id) {
+  auto [fontIt, added] = glyphs.try_emplace(font);
+  if (added)
+    g_object_ref(font);
+  auto &byId = fontIt->second;
+  if (const auto it = byId.find(id); it != byId.end())
+    return &it->second;
+
+  PangoRectangle ink;
+  pango_font_get_glyph_extents(font, id, &ink, nullptr);
+  pango_extents_to_pixels(&ink, nullptr);
+  // a pixel of padding for the antialiasing
+  const int w = ink.width + 2, h = ink.height + 2;
+  if (shelfX + w > ATLAS_SIZE) {
+    shelfY += shelfHeight;
+    shelfX = shelfHeight = 0;
+  }
+  if (w > ATLAS_SIZE || shelfY + h > ATLAS_SIZE)
+    return nullptr;
+
+  auto *surface = cairo_image_surface_create(CAIRO_FORMAT_A8, w, h);
+  auto *cr = cairo_create(surface);
+  auto *string = pango_glyph_string_new();
+  pango_glyph_string_set_size(string, 1);
+  string->glyphs[0] = PangoGlyphInfo{};
+  string->glyphs[0].glyph = id;
+  string->glyphs[0].attr.is_cluster_start = 1;
+  cairo_move_to(cr, 1 - ink.x, 1 - ink.y);
+  pango_cairo_show_glyph_string(cr, font, string);
+  cairo_surface_flush(surface);
+
+  const auto *data = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  for (int y = 0; y < h; ++y)
+    std::memcpy(&atlas[(shelfY + y) * ATLAS_SIZE + shelfX], data + y * stride, w);
+
+  pango_glyph_string_free(string);
+  cairo_destroy(cr);
+  cairo_surface_destroy(surface);
+
+  const Glyph g{shelfX, shelfY, w, h, ink.x - 1, ink.y - 1};
+  shelfX += w;
+  shelfHeight = std::max(shelfHeight, h);
+  return &byId.emplace(id, g).first->second;
+}
+
+void TitleRasterizer::reset() {
+  for (const auto &[font, byId] : glyphs)
+    g_object_unref(font);
+  glyphs.clear();
+  shelfX = shelfY = shelfHeight = 0;
+}
+
+TitleBitmap TitleRasterizer::rasterize(const std::string &title, float maxWidth, int size, const std::string &font) {
+  setFont(size, font);
+  float width = 0.0f;
+  auto placed = shape(title, width);
+
+  // Cut from the middle, the start and end of a title tend to be the useful bits.
+  if (width > maxWidth && !placed.empty()) {
+    const float side = std::max(0.0f, (maxWidth - ellipsisWidth) / 2.0f);
+    size_t head = 0;
+    while (head < placed.size() && placed[head].pen + placed[head].advance <= side)
+      head++;
+    size_t tail = placed.size();
+    while (tail > head && width - placed[tail - 1].pen <= side)
+      tail--;
+
+    std::vector<Placed> cut(placed.begin(), placed.begin() + head);
+    float pen = head > 0 ? placed[head - 1].pen + placed[head - 1].advance : 0.0f;
+    for (auto p : ellipsis) {
+      p.pen += pen;
+      cut.push_back(p);
+    }
+    pen += ellipsisWidth;
+    const float shift = tail < placed.size() ? pen - placed[tail].pen : 0.0f;
+    for (size_t i = tail; i < placed.size(); ++i) {
+      auto p = placed[i];
+      p.pen += shift;
+      cut.push_back(p);
+    }
+    width = tail < placed.size() ? width + shift : pen;
+    placed = std::move(cut);
+  }
+
+  TitleBitmap out;
+  const int w = std::max(1, (int)std::ceil(width));
+  const int h = std::max(1, lineHeight);
+  out.size = {(double)w, (double)h};
+  out.pixels.assign((size_t)w * h * 4, 0);
+
+  for (const auto &p : placed) {
+    if (p.glyph == PANGO_GLYPH_EMPTY)
+      continue;
+    auto g = glyph(p.font, p.glyph);
+    if (!g) {
+      // atlas is full, start over. Glyphs already drawn are in the bitmap.
+      reset();
+      g = glyph(p.font, p.glyph);
+      if (!g)
+        continue;
+    }
+
+    const int ox = (int)std::round(p.pen + p.dx) + g->left;
+    const int oy = baseline + (int)std::round(p.dy) + g->top;
+    for (int y = std::max(0, -oy); y < g->height && oy + y < h; ++y) {
+      const auto *src = &atlas[(g->y + y) * ATLAS_SIZE + g->x];
+      auto *dst = &out.pixels[((size_t)(oy + y) * w) * 4];
+      for (int x = std::max(0, -ox); x < g->width && ox + x < w; ++x) {
+        auto *px = dst + (ox + x) * 4;
+        const uint8_t v = std::max(px[3], src[x]);
+        px[0] = px[1] = px[2] = px[3] = v;
+      }
+    }
+  }
+  return out;
+}
+
+float TitleCache::oversample() {
+  return std::max(1.0f, (float)Config::windowSizeActive);
+}
+
+TitleCache::TitleCache() {
+  worker = std::jthread([this](std::stop_token stop) { work(stop); });
+}
+
+TitleCache::~TitleCache() {
+  worker.request_stop();
+  requested.fetch_add(1);
+  requested.notify_one();
+}
+
+void TitleCache::work(std::stop_token stop) {
+  // Pango state is per thread, the rasterizer lives and dies here.
+  TitleRasterizer rasterizer;
+  uint64_t seen = 0;
+  while (!stop.stop_requested()) {
+    auto request = requests.pop();
+    if (!request) {
+      requested.wait(seen);
+      seen = requested.load();
+      continue;
+    }
+
+    Result result{std::move(request->key), rasterizer.rasterize(request->title, request->maxWidth, request->size, request->font)};
+    while (!results.push(std::move(result)) && !stop.stop_requested())
+      std::this_thread::yield();
+  }
+}
+
+std::optional<TitleSlot> TitleCache::get(const std::string &title, int maxWidth) {
+  // same font as the rest of Hyprland's text
+  static const auto FONT = CConfigValue<Hyprlang::STRING>("misc:font_family");
+  const int size = std::round(Config::fontSize * oversample());
+  const std::string_view font = *FONT ? *FONT : "";
+  auto key = std::format("{}:{}:{}:{}", font, size, maxWidth, title);
+  if (const auto it = index.find(key); it != index.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    if (!it->second->box)
+      return std::nullopt;
+    return TitleSlot{*it->second->box, it->second->generation};
+  }
+
+  // Full queue, ask again next frame.
+  if (!requests.push(Request{key, title, maxWidth * oversample(), size, std::string(font)}))
+    return std::nullopt;
+  requested.fetch_add(1);
+  requested.notify_one();
+  inflight++;
+
+  lru.push_front({std::move(key), std::nullopt});
+  index[lru.front().key] = lru.begin();
+  if (lru.size() > MAX_TITLES)
+    evict(std::prev(lru.end()));
+  return std::nullopt;
+}
+
+bool TitleCache::valid(const TitleSlot &slot) const {
+  return placed.contains(slot.generation);
+}
+
+void TitleCache::use(const TitleSlot &slot) {
+  if (const auto it = placed.find(slot.generation); it != placed.end())
+    lru.splice(lru.begin(), lru, it->second);
+}
+
+SP<CTexture> TitleCache::texture() const {
+  return page;
+}
+
+std::pair<Vector2D, Vector2D> TitleCache::uv(const TitleSlot &slot) const {
+  return {slot.box.pos() / PAGE_SIZE, (slot.box.pos() + slot.box.size()) / PAGE_SIZE};
+}
+
+// Evicted cells first, smallest that fits, then shelves at the bottom.
+std::optional<CBox> TitleCache::place(const TitleBitmap &bitmap) {
+  const int w = bitmap.size.x, h = bitmap.size.y;
+  const int cw = w + PADDING, ch = h + PADDING;
+  if (cw > PAGE_SIZE.x || ch > PAGE_SIZE.y)
+    return std::nullopt;
+
+  auto best = freed.end();
+  for (auto it = freed.begin(); it != freed.end(); ++it) {
+    if (it->width >= cw && it->height >= ch && (best == freed.end() || it->width * it->height < best->width * best->height))
+      best = it;
+  }
+  if (best != freed.end()) {
+    const CBox cell = *best;
+    freed.erase(best);
+    if (cell.width > cw)
+      freed.emplace_back(cell.x + cw, cell.y, cell.width - cw, cell.height);
+    if (cell.height > ch)
+      freed.emplace_back(cell.x, cell.y + ch, (double)cw, cell.height - ch);
+    return CBox{cell.x, cell.y, (double)w, (double)h};
+  }
+  if (shelfX + w + PADDING > PAGE_SIZE.x) {
+    shelfY += shelfHeight;
+    shelfX = shelfHeight = 0;
+  }
+  if (shelfY + h + PADDING > PAGE_SIZE.y)
+    return std::nullopt;
+
+  const CBox box{(double)shelfX, (double)shelfY, (double)w, (double)h};
+  shelfX += w + PADDING;
+  shelfHeight = std::max(shelfHeight, h + PADDING);
+  return box;
+}
+
+void TitleCache::evict(std::list<Entry>::iterator it) {
+  if (it->box && !it->box->empty())
+    release(*it->box);
+  placed.erase(it->generation);
+  index.erase(it->key);
+  lru.erase(it);
+}
+
+void TitleCache::release(const CBox &box) {
+  CBox cell{box.x, box.y, box.width + PADDING, box.height + PADDING};
+  for (bool merged = true; merged;) {
+    merged = false;
+    for (auto it = freed.begin(); it != freed.end(); ++it) {
+      const bool row = it->y == cell.y && it->height == cell.height && (it->x + it->width == cell.x || cell.x + cell.width == it->x);
+      const bool column = it->x == cell.x && it->width == cell.width && (it->y + it->height == cell.y || cell.y + cell.height == it->y);
+      if (!row && !column)
+        continue;
+      cell = CBox{std::min(cell.x, it->x), std::min(cell.y, it->y), row ? cell.width + it->width : cell.width, column ? cell.height + it->height : cell.height};
+      freed.erase(it);
+      merged = true;
+      break;
+    }
+  }
+  freed.push_back(cell);
+}
+
+bool TitleCache::poll() {
+  bool uploaded = false;
+  while (auto result = results.pop()) {
+    inflight--;
+    // evicted or cleared while it was cooking
+    const auto it = index.find(result->key);
+    if (it == index.end())
+      continue;
+
+    const auto &bitmap = result->bitmap;
+    auto box = place(bitmap);
+    // Full. Make room from the least recently drawn end, those cards notice
+    // their slot went stale and ask again if they're still around.
+    while (!box) {
+      auto victim = std::find_if(lru.rbegin(), lru.rend(), [&](const Entry &entry) { return entry.box && !entry.box->empty() && entry.key != result->key; });
+      if (victim == lru.rend())
+        break;
+      evict(std::prev(victim.base()));
+      box = place(bitmap);
+    }
+    if (!box && placed.empty()) {
+      // freed cells too chopped up for it, start over
+      reset();
+      box = place(bitmap);
+    }
+    // too wide for any page, don't keep asking
+    it->second->box = box.value_or(CBox{});
+    if (!box)
+      continue;
+    it->second->generation = ++generation;
+    placed[generation] = it->second;
+
+    if (!page) {
+      const std::vector<uint8_t> blank((size_t)PAGE_SIZE.x * PAGE_SIZE.y * 4, 0);
+      page = makeShared<CTexture>(DRM_FORMAT_ABGR8888, (uint8_t *)blank.data(), PAGE_SIZE.x * 4, PAGE_SIZE);
+    }
+    glBindTexture(GL_TEXTURE_2D, page->m_texID);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+    const int cw = std::min<int>(box->width + PADDING, PAGE_SIZE.x - box->x), ch = std::min<int>(box->height + PADDING, PAGE_SIZE.y - box->y);
+    scratch.assign((size_t)cw * ch * 4, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, box->x, box->y, cw, ch, GL_RGBA, GL_UNSIGNED_BYTE, scratch.data());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, box->x, box->y, box->width, box->height, GL_RGBA, GL_UNSIGNED_BYTE, bitmap.pixels.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    uploaded = true;
+  }
+  return uploaded;
+}
+
+bool TitleCache::pending() const {
+  return inflight > 0;
+}
+
+void TitleCache::clear() {
+  index.clear();
+  lru.clear();
+  reset();
+}
+
+void TitleCache::reset() {
+  page.reset();
+  shelfX = shelfY = shelfHeight = 0;
+  freed.clear();
+  placed.clear();
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "defines.hpp"
+#include "helpers.hpp"
+#include <array>
+#include <atomic>
+#include <hyprutils/math/Box.hpp>
+#include <hyprutils/math/Vector2D.hpp>
+#include <list>
+#include <optional>
+#include <src/render/Texture.hpp>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef struct _PangoLayout PangoLayout;
+typedef struct _PangoFont PangoFont;
+
+// White text on transparent, premultiplied RGBA.
+struct TitleBitmap {
+  std::vector<uint8_t> pixels;
+  Vector2D size;
+};
+
+// Shapes titles with Pango and composites them from a glyph atlas, so a glyph
+// is rasterized once no matter how many titles use it. Truncation is measured
+// from the shaped advances instead of guessed from the font size.
+// CPU only, doesn't touch GL.
+class TitleRasterizer {
+public:
+  TitleRasterizer();
+  ~TitleRasterizer();
+  TitleBitmap rasterize(const std::string &title, float maxWidth, int pixelSize, const std::string &font);
+
+private:
+  struct Glyph {
+    // in the atlas
+    int x, y, width, height;
+    // from the pen position on the baseline
+    int left, top;
+  };
+
+  struct Placed {
+    PangoFont *font;
+    uint32_t glyph;
+    float pen, dx, dy, advance;
+  };
+
+  void setFont(int size, const std::string &family);
+  std::vector<Placed> shape(const std::string &text, float &width);
+  const Glyph *glyph(PangoFont *font, uint32_t id);
+  void reset();
+
+  PangoLayout *layout = nullptr;
+  int pixelSize = 0;
+  std::string family;
+  int baseline = 0;
+  int lineHeight = 0;
+  std::vector<Placed> ellipsis;
+  float ellipsisWidth = 0.0f;
+
+  // A8 coverage, packed in rows
+  static constexpr int ATLAS_SIZE = 1024;
+  std::vector<uint8_t> atlas;
+  int shelfX = 0, shelfY = 0, shelfHeight = 0;
+  std::unordered_map<PangoFont *, std::unordered_map<uint32_t, Glyph>> glyphs;
+};
+
+// Where a title sits in the title page. Stale once it's evicted.
+struct TitleSlot {
+  CBox box;
+  // stamp of the placement, never reused
+  uint64_t generation = 0;
+};
+
+// Laid-out titles, shared by every card and kept across activations, at
+// most MAX_TITLES of them, the least recently asked for go first.
+// Shaping and rasterizing happen on a worker thread; get() never blocks and
+// returns nothing until the title arrives. Only the upload is done here.
+// All titles live in one texture so a whole row of cards can be drawn in a
+// single call. When it fills up the least recently used titles make room,
+// one slot at a time.
+class TitleCache {
+public:
+  TitleCache();
+  ~TitleCache();
+  std::optional<TitleSlot> get(const std::string &title, int maxWidth);
+  bool valid(const TitleSlot &slot) const;
+  // The title was drawn, keeps it from being evicted.
+  void use(const TitleSlot &slot);
+  SP<CTexture> texture() const;
+  std::pair<Vector2D, Vector2D> uv(const TitleSlot &slot) const;
+  // Uploads finished titles, returns whether there were any. Render thread.
+  bool poll();
+  bool pending() const;
+  void clear();
+  // Titles are rendered this much larger than font_size, so the active card
+  // isn't upscaled. Everything else is drawn scaled down.
+  static float oversample();
+
+private:
+  struct Entry {
+    std::string key;
+    // empty while the worker is still on it
+    std::optional<CBox> box;
+    uint64_t generation = 0;
+  };
+
+  struct Request {
+    std::string key;
+    std::string title;
+    float maxWidth = 0.0f;
+    int size = 0;
+    // misc:font_family, read on the main thread
+    std::string font;
+  };
+
+  struct Result {
+    std::string key;
+    TitleBitmap bitmap;
+  };
+
+  void work(std::stop_token stop);
+  std::optional<CBox> place(const TitleBitmap &bitmap);
+  void evict(std::list<Entry>::iterator it);
+  void release(const CBox &box);
+  void reset();
+
+  // most recently asked for first
+  std::list<Entry> lru;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  // placed entries by generation
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> placed;
+  size_t inflight = 0;
+
+  static inline const Vector2D PAGE_SIZE = {2048, 1024};
+  SP<CTexture> page;
+  int shelfX = 0, shelfY = 0, shelfHeight = 0;
+  // evicted cells, padding included
+  std::vector<CBox> freed;
+  uint64_t generation = 0;
+  // zeroes a cell before a title goes in, so nothing old shows in the padding
+  std::vector<uint8_t> scratch;
+
+  SpscQueue<Request, 64> requests;
+  SpscQueue<Result, 64> results;
+  // bumped on every request, the worker sleeps on it
+  std::atomic<uint64_t> requested = 0;
+  std::jthread worker;
+};
@@ -0,0 +1,339 @@
+#include "worker.hpp"
+#include "container.hpp"
+#include "manager.hpp"
+#include <EGL/eglext.h>
+#define private public
+#include <src/render/OpenGL.hpp>
+#include <src/render/Renderer.hpp>
+#undef private
+
+// Captures in flight at once, the queues never have to hold more.
+static constexpr size_t MAX_PENDING = 32;
+
+static const char *VERTEX = R"#(#version 300 es
+precision highp float;
+uniform vec4 box;
+uniform vec2 size;
+layout(location = 0) in vec2 corner;
+out vec2 uv;
+
+void main() {
+  uv = corner;
+  gl_Position = vec4((box.xy + corner * box.zw) / size * 2.0 - 1.0, 0.0, 1.0);
+}
+)#";
+
+static const char *FRAGMENT = R"#(#version 300 es
+precision highp float;
+uniform sampler2D tex;
+uniform bool opaque;
+in vec2 uv;
+out vec4 fragColor;
+
+void main() {
+  vec4 color = texture(tex, uv);
+  fragColor = opaque ? vec4(color.rgb, 1.0) : color;
+}
+)#";
+
+static GLuint compile(GLenum type, const char *source) {
+  const GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source, nullptr);
+  glCompileShader(shader);
+  GLint ok = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+static GLuint link(const char *vertex, const char *fragment) {
+  const GLuint vs = compile(GL_VERTEX_SHADER, vertex);
+  const GLuint fs = compile(GL_FRAGMENT_SHADER, fragment);
+  GLuint program = 0;
+  if (vs && fs) {
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+  return program;
+}
+
+// Cards are told about their captures only once these are out of inflight.
+// Swapping slots can free a page, which asks done() about what's left.
+template <typename F>
+void SnapshotWorker::take(F &&pred) {
+  landed.clear();
+  for (auto it = inflight.begin(); it != inflight.end();) {
+    if (!pred(*it)) {
+      ++it;
+      continue;
+    }
+    landed.emplace_back(std::move(*it));
+    it = inflight.erase(it);
+  }
+}
+
+SnapshotWorker::~SnapshotWorker() {
+  stop();
+  if (inflight.empty())
+    return;
+  g_pHyprRenderer->makeEGLCurrent();
+  take([](const Pending &) { return true; });
+  for (auto &p : landed) {
+    glDeleteSync(p.result->done);
+    if (p.card)
+      p.card->finishSnapshot(p.slot, p.seq, false);
+    else if (manager)
+      manager->atlas.release(p.slot);
+  }
+}
+
+bool SnapshotWorker::start() {
+  if (broken)
+    return false;
+  if (thread.joinable())
+    return true;
+
+  display = g_pHyprOpenGL->m_eglDisplay;
+  const EGLint attribs[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 0, EGL_NONE};
+  context = eglCreateContext(display, EGL_NO_CONFIG_KHR, g_pHyprOpenGL->m_eglContext, attribs);
+  if (context == EGL_NO_CONTEXT) {
+    LOG(ERR, "snapshot worker: no shared context (egl error {:#x}), capturing on the compositor thread", eglGetError());
+    broken = true;
+    return false;
+  }
+  thread = std::jthread([this](std::stop_token stop) { work(stop); });
+  return true;
+}
+
+void SnapshotWorker::stop() {
+  if (!thread.joinable())
+    return;
+  thread.request_stop();
+  queued.fetch_add(1);
+  queued.notify_one();
+  thread.join();
+
+  // The worker is gone, whatever it left behind is ours now. Captures it
+  // never got to are lost, those cards capture again.
+  g_pHyprRenderer->makeEGLCurrent();
+  while (auto job = jobs.pop())
+    glDeleteSync(job->ready);
+  collect();
+  take([](const Pending &p) { return !p.result; });
+  for (auto &p : landed) {
+    if (p.card)
+      p.card->finishSnapshot(p.slot, p.seq, false);
+    else if (manager)
+      manager->atlas.release(p.slot);
+  }
+  landed.clear();
+  eglDestroyContext(display, context);
+  context = EGL_NO_CONTEXT;
+}
+
+bool SnapshotWorker::submit(WindowCard *card, const AtlasSlot &slot, uint64_t seq, Capture &&capture, std::vector<SP<CTexture>> &&textures) {
+  if (broken || !thread.joinable() || inflight.size() >= MAX_PENDING)
+    return false;
+
+  // Everything the compositor did to these textures so far, the worker waits for it.
+  g_pHyprRenderer->makeEGLCurrent();
+  Job job{glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), std::move(capture)};
+  glFlush();
+  if (!jobs.push(std::move(job))) {
+    glDeleteSync(job.ready);
+    return false;
+  }
+  queued.fetch_add(1);
+  queued.notify_one();
+  inflight.emplace_back(Pending{card, slot, seq, ++serial, std::move(textures), std::nullopt});
+  return true;
+}
+
+void SnapshotWorker::track(WindowCard *card, const AtlasSlot &slot, uint64_t seq, GLsync fence) {
+  inflight.emplace_back(Pending{card, slot, seq, ++serial, {}, Result{fence, true}});
+}
+
+void SnapshotWorker::collect() {
+  for (auto &p : inflight) {
+    if (p.result)
+      continue;
+    auto result = results.pop();
+    if (!result)
+      return;
+    p.result = *result;
+  }
+}
+
+const std::vector<WindowCard *> &SnapshotWorker::poll() {
+  finished.clear();
+  if (inflight.empty())
+    return finished;
+
+  if (broken && thread.joinable()) {
+    LOG(ERR, "snapshot worker: shader didn't build, capturing on the compositor thread");
+    stop();
+    return finished;
+  }
+
+  // Any capture whose fence has signalled lands, in whatever order.
+  collect();
+  g_pHyprRenderer->makeEGLCurrent();
+  take([](const Pending &p) {
+    if (!p.result || glClientWaitSync(p.result->done, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+      return false;
+    glDeleteSync(p.result->done);
+    return true;
+  });
+  for (auto &p : landed) {
+    if (!p.card)
+      manager->atlas.release(p.slot);
+    else if (p.card->finishSnapshot(p.slot, p.seq, p.result->ok))
+      finished.emplace_back(p.card);
+  }
+  landed.clear();
+  return finished;
+}
+
+bool SnapshotWorker::pending() const {
+  return !inflight.empty();
+}
+
+uint64_t SnapshotWorker::issued() const {
+  return serial;
+}
+
+// inflight is in the order captures were queued, whatever landed is gone from it
+bool SnapshotWorker::done(uint64_t serial) const {
+  return inflight.empty() || inflight.front().serial > serial;
+}
+
+bool SnapshotWorker::forget(WindowCard *card) {
+  bool found = false;
+  for (auto &p : inflight) {
+    if (p.card == card) {
+      p.card = nullptr;
+      found = true;
+    }
+  }
+  std::erase(finished, card);
+  return found;
+}
+
+void SnapshotWorker::work(std::stop_token stop) {
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+  program = link(VERTEX, FRAGMENT);
+  if (program) {
+    uniforms = {
+        .box = glGetUniformLocation(program, "box"),
+        .size = glGetUniformLocation(program, "size"),
+        .tex = glGetUniformLocation(program, "tex"),
+        .opaque = glGetUniformLocation(program, "opaque"),
+    };
+
+    static constexpr float CORNERS[] = {0, 0, 1, 0, 0, 1, 1, 1};
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &quad);
+    glBindBuffer(GL_ARRAY_BUFFER, quad);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CORNERS), CORNERS, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+    // Filtering comes from a sampler object, the textures' own parameters
+    // belong to the compositor.
+    glGenSamplers(1, &sampler);
+    glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  } else
+    broken = true;
+
+  uint64_t seen = 0;
+  while (!stop.stop_requested()) {
+    auto job = jobs.pop();
+    if (!job) {
+      queued.wait(seen);
+      seen = queued.load();
+      continue;
+    }
+
+    glWaitSync(job->ready, 0, GL_TIMEOUT_IGNORED);
+    glDeleteSync(job->ready);
+    Result result;
+    result.ok = program && render(job->capture);
+    result.done = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    while (!results.push(std::move(result)) && !stop.stop_requested())
+      std::this_thread::yield();
+  }
+
+  glDeleteSamplers(1, &sampler);
+  glDeleteBuffers(1, &quad);
+  glDeleteVertexArrays(1, &vao);
+  glDeleteProgram(program);
+  program = quad = vao = sampler = 0;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+// Same as a pass of PreviewAtlas::snapshot() for one card: the front slot
+// copied over, black under the clip, then the surfaces on top.
+bool SnapshotWorker::render(const Capture &capture) {
+  // framebuffers aren't shared between contexts, the pages get theirs here
+  GLuint fbs[2] = {0, 0};
+  glGenFramebuffers(2, fbs);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbs[0]);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, capture.page, 0);
+  bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  if (ok && capture.from) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbs[1]);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, capture.from, 0);
+    ok = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (ok) {
+      const auto &a = capture.fromBox, &b = capture.box;
+      glBlitFramebuffer(a.x, a.y, a.x + a.width, a.y + a.height, b.x, b.y, b.x + b.width, b.y + b.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbs[0]);
+  }
+  if (ok) {
+    glViewport(0, 0, capture.pageSize.x, capture.pageSize.y);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(capture.clip.x, capture.clip.y, capture.clip.width, capture.clip.height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glUseProgram(program);
+    glBindVertexArray(vao);
+    glActiveTexture(GL_TEXTURE0);
+    glBindSampler(0, sampler);
+    glUniform1i(uniforms.tex, 0);
+    glUniform2f(uniforms.size, capture.pageSize.x, capture.pageSize.y);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    for (const auto &draw : capture.draws) {
+      glBindTexture(GL_TEXTURE_2D, draw.texture);
+      glUniform4f(uniforms.box, draw.box.x, draw.box.y, draw.box.width, draw.box.height);
+      glUniform1i(uniforms.opaque, draw.opaque);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glDisable(GL_SCISSOR_TEST);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(2, fbs);
+  return ok;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "atlas.hpp"
+#include "defines.hpp"
+#include "helpers.hpp"
+#include <EGL/egl.h>
+#include <GLES3/gl32.h>
+#include <atomic>
+#include <deque>
+#include <hyprutils/math/Box.hpp>
+#include <hyprutils/math/Vector2D.hpp>
+#include <src/render/Texture.hpp>
+#include <thread>
+#include <vector>
+
+class WindowCard;
+
+// Renders preview captures on a thread of its own, with an EGL context shared
+// with the compositor's, see async_snapshots. The compositor thread only
+// gathers what to draw and fences it; the worker waits on that fence on the
+// GPU, draws into the atlas page and fences its own work. Finished captures
+// come back through a lock-free queue and are taken by poll() once their
+// fence has signalled, so slow captures never hold up the compositor's frames.
+// Captures rendered on the compositor thread are fenced and wait here too,
+// a card only swaps to its new slot once the GPU is done with it.
+// SP<>s stay on the compositor thread, the worker only sees GL names.
+class SnapshotWorker {
+public:
+  struct Draw {
+    GLuint texture;
+    // RGBX buffers, whatever is in alpha is ignored
+    bool opaque;
+    // in page pixels
+    CBox box;
+  };
+
+  // Everything in page pixels.
+  struct Capture {
+    GLuint page = 0;
+    Vector2D pageSize;
+    // the slot captured into
+    CBox box;
+    // page and box the unchanged parts are copied from, 0 for none
+    GLuint from = 0;
+    CBox fromBox;
+    // all drawing is scissored to this
+    CBox clip;
+    std::vector<Draw> draws;
+  };
+
+  ~SnapshotWorker();
+  // Starts the thread on first use. False if it can't run, captures are then
+  // done on the compositor thread as before.
+  bool start();
+  void stop();
+  // Queues a capture of card into slot. textures holds every texture the
+  // draws name until the capture is done. False if the queue is full.
+  bool submit(WindowCard *card, const AtlasSlot &slot, uint64_t seq, Capture &&capture, std::vector<SP<CTexture>> &&textures);
+  // A capture into slot rendered on this thread, done once fence signals.
+  void track(WindowCard *card, const AtlasSlot &slot, uint64_t seq, GLsync fence);
+  // Cards whose capture the GPU finished since the last call. Compositor thread.
+  const std::vector<WindowCard *> &poll();
+  bool pending() const;
+  // Serial of the last capture queued or tracked, and whether the GPU got
+  // through every capture up to and including serial.
+  uint64_t issued() const;
+  bool done(uint64_t serial) const;
+  // The card lets go of its capture. The slot stays taken until the capture
+  // comes back and is then given back to the atlas, the GPU may still be
+  // drawing into it. False if there was nothing in flight for card.
+  bool forget(WindowCard *card);
+
+private:
+  struct Job {
+    // compositor side of the textures, waited on before drawing
+    GLsync ready = nullptr;
+    Capture capture;
+  };
+
+  struct Result {
+    // worker side, signalled once the capture is in the page
+    GLsync done = nullptr;
+    bool ok = false;
+  };
+
+  // What the compositor thread remembers about a queued capture.
+  struct Pending {
+    WindowCard *card;
+    AtlasSlot slot;
+    uint64_t seq;
+    uint64_t serial;
+    std::vector<SP<CTexture>> textures;
+    std::optional<Result> result;
+  };
+
+  void work(std::stop_token stop);
+  bool render(const Capture &capture);
+  // Matches results with the worker's captures in flight, they come back in order.
+  void collect();
+  template <typename F>
+  void take(F &&pred);
+
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLContext context = EGL_NO_CONTEXT;
+  // no shared context or no shader, don't keep trying
+  std::atomic<bool> broken = false;
+
+  // worker-only GL objects
+  GLuint program = 0;
+  GLuint quad = 0;
+  GLuint vao = 0;
+  GLuint sampler = 0;
+  struct {
+    GLint box, size, tex, opaque;
+  } uniforms;
+
+  std::deque<Pending> inflight;
+  uint64_t serial = 0;
+  // scratch for take()
+  std::vector<Pending> landed;
+  std::vector<WindowCard *> finished;
+
+  SpscQueue<Job, 32> jobs;
+  SpscQueue<Result, 32> results;
+  // bumped on every job, the worker sleeps on it
+  std::atomic<uint64_t> queued = 0;
+  std::jthread thread;
+};
@@ -0,0 +1,57 @@
+// The layout and snapshot budget work every tick does while the carousel is
+// open must not go to the heap once the buffers are sized. Needs
+// -DCOUNT_ALLOCATIONS=ON, run with ctest.
+#include "alloc.hpp"
+#include "scheduler.hpp"
+#include "styles.hpp"
+#include <cstdio>
+#include <memory>
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what, uint64_t got) {
+  if (ok)
+    return;
+  std::fprintf(stderr, "FAIL: %s (%llu)\n", what, (unsigned long long)got);
+  failures++;
+}
+
+int main() {
+#define X(type, name, conf, def) Config::name = def;
+  CONFIG_VARS
+#undef X
+
+  // the counter has to see our own allocations in the first place
+  auto before = allocationCount();
+  auto probe = std::make_unique<int>(1);
+  expect(allocationCount() - before == 1, "operator new isn't counted", allocationCount() - before);
+
+  static constexpr size_t CARDS = 48;
+  std::vector<Vector2D> surfaceSizes(CARDS);
+  for (size_t i = 0; i < CARDS; ++i)
+    surfaceSizes[i] = {1280.0 + i * 16, 720.0 + i * 9};
+
+  Carousel carousel;
+  RenderBatch layout;
+  SnapshotScheduler scheduler;
+  StyleContext ctx{0, CARDS, 0, 0.0f, 1.0f, 1.0f, {2560, 1440}, {0, 0}};
+  // first frame sizes the buffers
+  carousel.calculateBatch(ctx, surfaceSizes, layout);
+
+  before = allocationCount();
+  float z = 0.0f;
+  for (int frame = 0; frame < 240; ++frame) {
+    scheduler.beginFrame();
+    ctx.rotation = frame * 0.01f;
+    ctx.activeIndex = frame % CARDS;
+    carousel.calculateBatch(ctx, surfaceSizes, layout);
+    for (size_t i = 0; i < layout.size(); ++i)
+      z += layout.at(i).z;
+    scheduler.spend(scheduler.available(), FloatTime(0.0005f));
+  }
+  expect(allocationCount() - before == 0, "settled frames allocated", allocationCount() - before);
+
+  if (failures == 0)
+    std::printf("ok (%f)\n", z);
+  return failures == 0 ? 0 : 1;
+}